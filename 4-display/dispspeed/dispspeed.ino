@@ -0,0 +1,77 @@
+// dispspeed.ino - timing benchmark for TM1650 full-frame updates: Wire versus own bit-banged driver
+// board: Generic ESP8266 module
+
+#include <Wire.h>
+#include "tm1650.h"
+
+#define SCL_PIN 12
+#define SDA_PIN 13
+
+#define FRAMES 200 // Number of full-frame updates per measurement
+
+// Segments (board wiring, BFAEDCGP) for the digits 0..9
+static const uint8_t digits[10] = { 0xFC, 0x84, 0xBA, 0xAE, 0xC6, 0x6E, 0x7E, 0xA4, 0xFE, 0xEE };
+
+// Control: brightness 1, 8 segments, power on
+#define CONTROL 0x11
+
+// Full frame (four digits plus control) with Wire: five transactions
+static int wire_frame(const uint8_t * segs, uint8_t control) {
+  int errors = 0;
+  for( int i=0; i<4; i++ ) {
+    Wire.beginTransmission(0x34+i); // register 0x68+2i DIGxDATA
+    Wire.write(segs[i]);
+    errors += Wire.endTransmission()!=0;
+  }
+  Wire.beginTransmission(0x24); // register 0x48 DIG1CTRL
+  Wire.write(control);
+  errors += Wire.endTransmission()!=0;
+  return errors;
+}
+
+// Shows a frame counter (n) on the display, so that a glitch at too high a clock is visible
+static void frame_make(int n, uint8_t * segs) {
+  segs[0] = digits[n/1000%10];
+  segs[1] = digits[n/100%10];
+  segs[2] = digits[n/10%10];
+  segs[3] = digits[n%10];
+}
+
+static void bench_wire(uint32_t hz) {
+  Wire.begin(SDA_PIN,SCL_PIN);
+  Wire.setClock(hz);
+  uint8_t segs[4];
+  int errors = 0;
+  uint32_t t0 = micros();
+  for( int n=0; n<FRAMES; n++ ) { frame_make(n,segs); errors += wire_frame(segs,CONTROL); }
+  uint32_t t1 = micros();
+  Serial.printf("Wire   %7u Hz: %4u us/frame (%d errors)\n", hz, (t1-t0)/FRAMES, errors);
+}
+
+static void bench_tm1650(uint32_t hz) {
+  tm1650_init(hz);
+  uint8_t segs[4];
+  int errors = 0;
+  uint32_t t0 = micros();
+  for( int n=0; n<FRAMES; n++ ) { frame_make(n,segs); errors += tm1650_frame(segs,CONTROL); }
+  uint32_t t1 = micros();
+  Serial.printf("tm1650 %7u Hz: %4u us/frame (%d missing acks)\n", hz, (t1-t0)/FRAMES, errors);
+}
+
+void setup() {
+  Serial.begin(115200);
+  Serial.printf("\n\ndispspeed.ino\n");
+  Serial.printf("CPU %d MHz, %d frames per measurement\n\n", ESP.getCpuFreqMHz(), FRAMES);
+}
+
+void loop() {
+  bench_wire(100000);
+  bench_wire(400000);
+  bench_tm1650(100000);
+  bench_tm1650(400000);
+  bench_tm1650(800000);
+  bench_tm1650(1000000);
+  bench_tm1650(2000000);
+  Serial.printf("\n");
+  delay(5000);
+}
@@ -21,17 +21,14 @@
 #define LOGDBG(...)  LOGDBGX(CFG_LOGPREFIX ": " "DBG: " __VA_ARGS__)
 
 
-// One default definition of fields (containing just an ssid and password of a wifi network)
-NvmField CfgFieldsDefault[] = {
-  {"ssid"    , "MySSID"     , 32, "The ssid of the wifi network this device should connect to."    },
-  {"password", "MyPassword" , 32, "The password of the wifi network this device should connect to."},
-  {0         , 0            ,  0, 0},
-};
+// The layout of the default fields (CfgFieldsDefault, see Cfg.h)
+const NvmLayout CfgLayoutDefault = nvm_layout<CfgFieldsDefault>;
 
 
-Cfg::Cfg(const char*appname, NvmField*fields, int seriallvl, int ledpin) {
+Cfg::Cfg(const char*appname, const NvmLayout&layout, int seriallvl, int ledpin) {
   _appname = appname;
-  _fields = fields;
+  _layout = &layout;
+  _fields = layout.fields;
   _seriallvl = seriallvl;
   _ledpin = ledpin;
   _cfg = false;
@@ -40,20 +37,19 @@ Cfg::Cfg(const char*appname, NvmField*fields, int seriallvl, int ledpin) {
   _websrv = 0;
   _dnssrv = 0;
   _nvm_ = 0; // creation is delayed (the Nvm constructor prints errors to Serial)
-  _vals = 0; // creation is with creation of _nvm_
+  _nums = 0; // creation is with creation of _nvm_
 }
 
 
 Nvm* Cfg::_nvm(void) {
   // Getter which constructs on first use
   if( _nvm_==0 ) {
-    _nvm_ = new Nvm(_fields);
+    _nvm_ = new Nvm(*_layout);
     int count = _nvm_->count();
-    _vals = new char*[count];
+    _nums = new int32_t[count];
     for( int ix=0; ix<count; ix++ ) {
-      _vals[ix]= new char[ _fields[ix].len + 1 ]; // was NVM_MAX_LENZ
-      //_vals[ix]= new char[ NVM_MAX_LENZ ];
-      _nvm_->get(ix,_vals[ix]);
+      // The view is valid for the type, so parsing succeeds
+      nvm_parse(_fields[ix], _nvm_->view(ix), &_nums[ix]);
     }
     // _nvm_->dump();
   }
@@ -62,10 +58,7 @@ Nvm* Cfg::_nvm(void) {
 
 
 Cfg::~Cfg(void) {
-  if( _vals   !=0 ) {
-    for( int i=0; i<_nvm_->count(); i++ ) delete[] _vals[i];
-    delete[] _vals;
-  }
+  if( _nums   !=0 ) delete[] _nums;
   if( _nvm_  !=0 ) delete _nvm_;
   if( _dnssrv!=0 ) delete _dnssrv;
   if( _websrv!=0 ) delete _websrv;
@@ -102,18 +95,25 @@ bool Cfg::cfgmode(void) {
 }
 
 
-char * Cfg::getval(const char * name) {
+const char * Cfg::getval(const char * name) {
   return getval( _nvm()->find(name) );
 }
 
 
-char * Cfg::getval(int ix) {
-  char * s=0;
-  if( 0<=ix && ix<_nvm()->count() ) s=_vals[ix];
+const char * Cfg::getval(int ix) {
+  const char * s=0;
+  if( 0<=ix && ix<_nvm()->count() ) s=_nvm()->view(ix);
   return s;
 }
 
 
+int32_t Cfg::getnum(int ix) {
+  int32_t n=0;
+  if( 0<=ix && ix<_nvm()->count() ) n=_nums[ix];
+  return n;
+}
+
+
 static String mac(int len=WL_MAC_ADDR_LENGTH, bool soft=false) {
   uint8_t macbuf[WL_MAC_ADDR_LENGTH];
   char    hexbuf[3*WL_MAC_ADDR_LENGTH+1];
@@ -223,7 +223,7 @@ void Cfg::_handle_config(void) {
   LOGUSR("web: '%s' (config)\n",_websrv->uri().c_str() );  
   String body= String("\r\n    <div class='sub'>\r\n      <form action='save'><table>\r\n" );
  
-  NvmField * field = _fields;
+  const NvmField * field = _fields;
   while( field->name!=0 ) {
     if( field->len==0 ) {
       body+= String("\r\n")+
@@ -231,7 +231,7 @@ void Cfg::_handle_config(void) {
         "        <tr> <td colspan='3'><small>"+field->extra+"</small></th> </tr>\r\n"; 
     } else {
       char val[NVM_MAX_LENZ];
-      _nvm()->get(field->name,val);
+      _nvm()->get(field-_fields,val);
       body += String("") +
         "        <tr>\r\n"
         "          <td>"+field->name+"&nbsp;</td>\r\n"
@@ -256,6 +256,8 @@ void Cfg::_handle_save(void) {
   LOGDBG("web: %d args\n",_websrv->args() );                            
 
   String list="";
+  Nvm::Stats s0 = _nvm()->stats();
+  _nvm()->begin(); // All fields in one flash write
   for( int i=0; i<_websrv->args(); i++) {
     String name = _websrv->argName(i);
     String val = _websrv->arg(i);
@@ -264,15 +266,18 @@ void Cfg::_handle_save(void) {
     if( ix==-1 ) {
       LOGUSR("ignored: '%s' = '%s'\n",name.c_str(),val.c_str());       
     } else {
+      int32_t num;
+      if( _fields[ix].type.kind!=NVM_STR && !nvm_parse(_fields[ix], val.c_str(), &num) ) LOGUSR("invalid: '%s' = '%s' (default '%s' will be used)\n",name.c_str(),val.c_str(),_fields[ix].dft);
       _nvm()->put( ix, val.c_str());
-      memcpy(_vals[ix], val.c_str(), _fields[ix].len + 1 ); // was NVM_MAX_LENZ
-      _vals[ix][_fields[ix].len]='\0'; // ensure truncation
-      //memcpy(_vals[ix], val.c_str(), NVM_MAX_LENZ );
+      nvm_parse(_fields[ix], _nvm()->view(ix), &_nums[ix]);
       LOGUSR("saved: '%s' = '%s'\n", name.c_str(), val.c_str() );
       if( list!="") list+=", ";
       list+="<i>"+name+"</i>"; 
     }
   }  
+  bool ok = _nvm()->commit();
+  const Nvm::Stats & s1 = _nvm()->stats();
+  LOGUSR("nvm: %u unchanged, %u sector writes%s\n", (unsigned)(s1.unchanged-s0.unchanged), (unsigned)(s1.erases-s0.erases), ok?"":" (FAILED)" );
   
   if( list=="" ) list="Nothing to save."; else list="Saving "+list;
   String body= "    <div class='sub'>"+list+".<br/><br/>Will restart shortly.</div>\r\n";
@@ -3,6 +3,9 @@
 #define _CFG_H_
 /*
 REVISION HISTORY
+ v1.13.0 20261016  Typed fields parsed once (getnum), getval returns a view into the EEPROM (no copies)
+ v1.12.0 20261016  Fields are passed as a compile-time layout (nvm_layout<fields>), getval by compile-time id; API change: the constructor takes nvm_layout<fields>, not fields
+ v1.11.0 20261016  Saving writes the flash once (one Nvm transaction), and skips unchanged fields
  v1.10.0 20220528  Cfg uses less memory
  v1.9.0  20220430  Added CFG_VERSION
  v1.8.0  20220427  Fixed D3/D4 missing
@@ -15,7 +18,7 @@ REVISION HISTORY
  v1.1.0  20170427  Fix: urldecode on webvalues. New: default buttons on webpage. More efficient string handling.
  v1.0.0  20170416  Initial version
 */
-#define CFG_VERSION "1.10.0" // also in library.properties
+#define CFG_VERSION "1.13.0" // also in library.properties
 
 
 /*
@@ -103,17 +106,19 @@ When creating an instance of Cfg, there is one mandatory parameter 'appname',
 the application's name. It is used to form an SSID of the access point, and 
 to style the web page of the webserver.
 
-| Cfg(const char *appname, NvmField*fields=CfgFieldsDefault, int seriallvl=CFG_SERIALLVL_USR, int ledpin=D4);
+| Cfg(const char *appname, const NvmLayout&layout=CfgLayoutDefault, int seriallvl=CFG_SERIALLVL_USR, int ledpin=D4);
 
 So possible calls are
-| Cfg cfg("CfgDemo", CfgFieldsDefault, CFG_SERIALLVL_DBG, LED_PIN);
-| Cfg cfg("CfgDemo", CfgFieldsDefault, CFG_SERIALLVL_DBG);
-| Cfg cfg("CfgDemo", CfgFieldsDefault );
+| Cfg cfg("CfgDemo", nvm_layout<fields>, CFG_SERIALLVL_DBG, LED_PIN);
+| Cfg cfg("CfgDemo", nvm_layout<fields>, CFG_SERIALLVL_DBG);
+| Cfg cfg("CfgDemo", nvm_layout<fields> );
 | Cfg cfg("CfgDemo");
+Up to v1.11.0 the second parameter was the fields array itself; a call like 
+Cfg cfg("CfgDemo", fields) no longer compiles, pass nvm_layout<fields> instead.
 
 But the constructor has more parameters, all of which have a default. The 
-second parameter 'field' is an array describing the fields (key-value pairs), 
-see section FIELDS below for details.
+second parameter 'layout' is computed by the compiler from an array describing 
+the fields (key-value pairs), see section FIELDS below for details.
 
 The third parameter 'seriallvl' determines how much the Cfg module prints to 
 Serial, there are three flavors:
@@ -139,38 +144,47 @@ and then waits 'cfgwait' to see if the value changes.
 
 
 FIELDS
-The most complex parameter is the 'fields' in the constructor. It has three
+The most complex parameter is the 'layout' (of the fields) in the constructor. It has three
 major uses. First of all Cfg passes the fields to Nvm, which creates a memory
 layout for the eeprom (with offsets, sizes, checksums). Secondly, Cfg uses
 fields to create a webpage with edit boxes for each field. Finally, Cfg 
 offers the functions
-| char * getval(const char * name);
-| char * getval(int ix);
+| const char * getval(const char * name);
+| const char * getval(int ix);
+| int32_t      getnum(int ix);
 that allow the real application to query Cfg for the values of the fields.
+The strings returned by getval() point into the EEPROM (RAM mirror), they are
+not copies.
 
-The fields variable is an array, where each element is a field, the last
+The fields variable is a constexpr array, where each element is a field, the last
 field containing zero's to signal end-of-array. Each field consists of four
 values: the field name (a string), the default field value (also a string),
-the maximum field length (integer), and a description (string).
+the maximum field length (integer), and a description (string). The compiler
+checks the fields, and computes the layout, see Nvm.h.
 
-The default fields defines just the credentials for an access point.
-| NvmField CfgFieldsDefault[] = {
+The default fields defines just the credentials for an access point; it is
+defined in this header (so that NVM_ID and nvm_layout<> work on it), and
+CfgLayoutDefault is its layout.
+| inline constexpr NvmField CfgFieldsDefault[] = {
 |   {"ssid"    , "MySSID"     , 32, "The ssid of the wifi network this device should connect to."    },
 |   {"password", "MyPassword" , 32, "The password of the wifi network this device should connect to."},
 |   {0         , 0            ,  0, 0},  
 | };
+| extern const NvmLayout CfgLayoutDefault; // nvm_layout<CfgFieldsDefault>
 Note that cfg.getval("password") would give the same result as cfg.getval(1),
-since this fields definition has field "password" at index 1.
-
-Note that Cfg only supports string fields. This is because the Nvm and text 
-boxes on the web page are strings. This means that when there is a field like
-| {"interval", "300"          , 10, "The time (in seconds) between webserver requests for time."},
-one way to extract the integer is
-| int interval = String(cfg.getval("interval")).toInt();
-
-Also note that there is no input checking by Cfg, except that when the user 
-enters too long a string, this is truncated to the length specified in the 
-fields array.
+since this fields definition has field "password" at index 1. The latter is
+faster, and getval(NVM_ID(CfgFieldsDefault,"password")) has the compiler look up 
+the index (and fail the build on a typo).
+
+The Nvm and the text boxes on the web page store strings. But a field may have
+a type (see Nvm.h), in which case Cfg validates and parses the value once, when
+it loads the fields. For a field like
+| {"interval", "300", 10, "The time (in seconds) between webserver requests for time.", nvm_int(10,3600)},
+the integer is available as
+| int interval = cfg.getnum(NVM_ID(fields,"interval"));
+For a bool getnum() returns 0 or 1, for an enum the index of the value in its list. 
+A stored value that is not valid is replaced by the default. When the user enters 
+too long a string, this is truncated to the length specified in the fields array.
 
 From the fields, also the web page is generated. There are two "mark up" features.
 A field with a length of 0 generates a header (from name) and a sub-header (from extra).
@@ -197,23 +211,31 @@ When the the extra field ends in a space, the web page has a white-line below th
 #endif
 
 
-extern NvmField CfgFieldsDefault[];
+// One default definition of fields (containing just an ssid and password of a wifi network)
+inline constexpr NvmField CfgFieldsDefault[] = {
+  {"ssid"    , "MySSID"     , 32, "The ssid of the wifi network this device should connect to."    },
+  {"password", "MyPassword" , 32, "The password of the wifi network this device should connect to."},
+  {0         , 0            ,  0, 0},
+};
+extern const NvmLayout CfgLayoutDefault; // nvm_layout<CfgFieldsDefault>
 
 
 class Cfg
 {
   public:
-    Cfg(const char *appname, NvmField*fields=CfgFieldsDefault, int seriallvl=CFG_SERIALLVL_USR, int ledpin=D4);
+    Cfg(const char *appname, const NvmLayout&layout=CfgLayoutDefault, int seriallvl=CFG_SERIALLVL_USR, int ledpin=D4);
     ~Cfg(void);
     void check(int cfgwait=100, int butpin=D3);
     bool cfgmode(void);
     void setup(void);
     void loop(void);
-    char * getval(const char * name);
-    char * getval(int ix);
+    const char * getval(const char * name);
+    const char * getval(int ix);
+    int32_t getnum(int ix);
   private:
     const char*      _appname;   // Application name, used on serial prints, ssid, webpage
-    NvmField*        _fields;    // The fields that need to be configured
+    const NvmLayout* _layout;    // The layout of the fields
+    const NvmField*  _fields;    // The fields that need to be configured
     int              _seriallvl; // Level of feedback over serial port (debug, trace)
     int              _ledpin;    // The id of the led that is used for feedback
     int              _cfg;       // Persistent recording whether user selected configuration mode
@@ -222,7 +244,7 @@ class Cfg
     ESP8266WebServer*_websrv;    // Webserver for configuration mode
     DNSServer*       _dnssrv;    // DNS server
     Nvm*             _nvm_;      // Named strings in eeprom (use via _nvm() )
-    char**           _vals;      // The values from the nvm (local cache), so that a safe char* can be returned from getval()
+    int32_t*         _nums;      // The parsed values of the typed fields (see nvm_parse)
     void _handle_config(void);
     void _handle_save(void);
     void _handle_restart(void);
@@ -9,48 +9,53 @@
 #include "Nvm.h"
 
 
+#if NVM_LOG && NVMLOG_MAXLEN!=NVM_MAX_LENZ-1
+  #error NVMLOG_MAXLEN shall be NVM_MAX_LENZ-1
+#endif
+
+
 // The initial vector for the checksum (of the fields). 
 #define NVM_SUMINIT 0xAA // This value ensures that an all-0 or all-1 EEPROM does not have a matching checksum
 
 
 // Constructor, passing the NVM layout.
-// Prints errors in layout to Serial (so have that open).
-Nvm::Nvm(NvmField*fields) {
-  if( NVM_MAX_LENZ-1>255 ) Serial.printf("ERROR: NVM_MAX_LENZ (%d) shall be max 256\n", NVM_MAX_LENZ);
+// The layout was computed and checked at compile time (see NvmTables).
+Nvm::Nvm(const NvmLayout&layout) {
   // Store the layout
-  _fields = fields;
-  // Count the number of fields and run some checks.
-  _fieldcount = 0;
-  NvmField * f = fields;
-  while( f->name!=0 ) {
-    if( strlen(f->name)>NVM_MAX_LENZ-1 ) Serial.printf("ERROR: Nvm field '%s' has a name that exceeds len %d\n", f->name, NVM_MAX_LENZ-1);
-    if( f->len         >NVM_MAX_LENZ-1 ) Serial.printf("ERROR: Nvm field '%s' has len %d (but %d is max)\n", f->name, f->len, NVM_MAX_LENZ-1);
-    if( strlen(f->dft) >f->len         ) Serial.printf("ERROR: Nvm field '%s' has default '%s' with len %d which exceeds len %d\n", f->name, f->dft, strlen(f->dft), f->len);
-    f++;
-    _fieldcount++;
-  }
-  // Check sentinel for consistency
-  if( f->name  !=0 ) Serial.printf("ERROR: Nvm sentinel field has non-zero name '%s'\n", f->name);
-  if( f->dft   !=0 ) Serial.printf("ERROR: Nvm sentinel field has non-zero default '%s'\n", f->dft);
-  if( f->len   !=0 ) Serial.printf("ERROR: Nvm sentinel field has non-zero length %d\n", f->len);
-  if( f->extra !=0 ) Serial.printf("ERROR: Nvm sentinel field has non-zero extra %s\n", f->extra);
-  // Setup the array that records the start positions of the fields
-  _fieldstarts = new int[_fieldcount+1]; // Same length as _fields (which has a sentinel)
-  _fieldstarts[0] = 0; // Offset of first field.
+  _layout = &layout;
+  _fields = layout.fields;
+  _fieldstarts = layout.starts;
+  _fieldcount = layout.count;
+  _transaction = false;
+  _dirty = false;
+  _failed = false;
+  _stats = Stats();
+#if NVM_LOG
+  // Mount the journal (ids are field indices), and copy the values to an image with the EEPROM layout (so that view() works the same)
+  if( !_log.begin(_fieldcount) ) Serial.printf("ERROR: Nvm journal could not be mounted\n");
+  _image = new uint8_t[_fieldstarts[_fieldcount]];
+  memset(_image, 0xFF, _fieldstarts[_fieldcount]); // Invalid len
   for(int ix=0; ix<_fieldcount; ix++ ) {
-    //Serial.printf("INFO: %s @ 0x%04x # %d\n",_fields[ix].name,_fieldstarts[ix],_fields[ix].len);
-    _fieldstarts[ix+1] = _fieldstarts[ix] + 1+ fields[ix].len + 1 + 1; // Add 1 byte for len, len bytes for content, 1 for terminating zero, and 1 for checksum
+    char val[NVM_MAX_LENZ];
+    int len = _log.read(ix,val);
+    if( len>=0 && (unsigned)len<=_fields[ix].len ) _set(_image+_fieldstarts[ix],val,len); // Stored, and fits the layout
   }
+#else
   // Connect to the EEPROM. Note storage size used is _fieldstarts[_fieldcount];
   EEPROM.begin(_fieldstarts[_fieldcount]);
+#endif
   //Serial.printf("INFO: EEPROM size %d\n",_fieldstarts[_fieldcount]);
 }
 
 
 // Destructor
 Nvm::~Nvm(void) {
+#if NVM_LOG
+  _log.end();
+  delete[] _image;
+#else
   EEPROM.end();
-  delete[] _fieldstarts; 
+#endif
 }
 
 
@@ -61,7 +66,7 @@ int Nvm::count(void) {
 
 
 // Returns field definition for field with index ix (or NULL if ix out of range).
-NvmField* Nvm::field(int ix) {
+const NvmField* Nvm::field(int ix) {
   if( ix<0 || ix>=_fieldcount ) return 0;
   return &_fields[ix];
 }
@@ -70,7 +75,10 @@ NvmField* Nvm::field(int ix) {
 // Dumps the nvm (used part of EEPROM) to serial port.
 void Nvm::dump(char * prefix) {
   if( prefix==0 ) prefix=(char*)"";
-  int *start = _fieldstarts;
+#if NVM_LOG
+  _log.dump(prefix);
+#else
+  const uint16_t *start = _fieldstarts;
   int firstfree = _fieldstarts[_fieldcount]; 
   int address = 0;
   int  ix = 0;
@@ -95,15 +103,16 @@ void Nvm::dump(char * prefix) {
     if( name!=0 ) { Serial.printf(" %s",name); name=0; }
     Serial.printf("\n");
   }
+#endif
 }
 
 
 // Looks up the field with name 'name' and return its index (returns -1 if name is not found).
+// The perfect hash gives the only candidate, so there is at most one strcmp.
 int Nvm::find(const char * name) {
-  for(int ix=0; ix<_fieldcount; ix++ ) {
-    if( strcmp(_fields[ix].name,name)==0 ) return ix;
-  }
-  return -1;
+  int ix = _layout->slots[ nvm_hash(name,_layout->seed) & _layout->mask ];
+  if( ix==0xFF || strcmp(_fields[ix].name,name)!=0 ) return -1;
+  return ix;
 }
 
 
@@ -114,31 +123,50 @@ void Nvm::get(const char * name, char * val) {
 
 
 // Reads field with index ix  from EEPROM and stores that in 'val'. Note 'val' must be allocated by user (size NVM_MAX_LENZ). 
-// If EEPROM has invalid len, missing \0, or mismatching checksum, field(ix).dft is returned instead.
+// If EEPROM has invalid len, missing \0, mismatching checksum, or a value not valid for the field type, field(ix).dft is returned instead.
 void Nvm::get(int ix,char*val) {
+  strcpy(val,view(ix));
+}
+
+
+// Returns field with index ix, without copying: a pointer into the EEPROM (RAM mirror).
+// If EEPROM has invalid len, missing \0, mismatching checksum, or a value not valid for the field type, field(ix).dft is returned instead.
+const char * Nvm::view(int ix) {
   // Check index
   if( ix<0 || ix>=_fieldcount ) {
     Serial.printf("ERROR: index (%d) out of range (was the passed name valid?)\n",ix);
-    *val = '\0'; 
-    return;
+    return "";
   }
-  int address = _fieldstarts[ix];
+  const char * val = _stored(ix);
+  int32_t num;
+  if( val==0 || !nvm_parse(_fields[ix],val,&num) ) return _fields[ix].dft;
+  return val;
+}
+
+
+// Returns the value stored for field ix, or 0 if it has an invalid len, missing \0, or mismatching checksum.
+const char * Nvm::_stored(int ix) {
+#if NVM_LOG
+  const uint8_t * p = _image + _fieldstarts[ix];
+#else
+  const uint8_t * p = EEPROM.getConstDataPtr() + _fieldstarts[ix];
+#endif
   // Get string length
-  uint8_t sum = NVM_SUMINIT;
-  unsigned len = EEPROM.read(address++);
-  if( len>_fields[ix].len ) { strcpy(val,_fields[ix].dft); return; }
-  sum ^= len; // len is part of checksum
-  // Get chars
-  uint8_t* p= (uint8_t*)val;
-  for(unsigned i=0; i<=len; i++) { // Read also terminating zero (<= instead of <)
-    *p = EEPROM.read(address++);
-    sum ^= *p;
-    p++;
-  }
-  if( val[len]!='\0' ) { strcpy(val,_fields[ix].dft); return; }
-  // Get and compare checksum
-  uint8_t sum2 = EEPROM.read(address++);
-  if( sum!=sum2 )  { strcpy(val,_fields[ix].dft); return; }
+  unsigned len = p[0];
+  if( len>_fields[ix].len ) return 0;
+  // Check terminating zero and checksum (len is part of checksum)
+  if( p[1+len]!='\0' ) return 0;
+  uint8_t sum = NVM_SUMINIT ^ len;
+  for(unsigned i=0; i<len; i++) sum ^= p[1+i];
+  if( sum!=p[1+len+1] ) return 0;
+  return (const char *)p+1;
+}
+
+
+// Returns true iff field ix holds the first 'len' chars of 'val' (with valid len, terminating zero and checksum).
+bool Nvm::_equals(int ix,const char*val,unsigned len) {
+  const char * stored = _stored(ix);
+  return stored!=0 && strlen(stored)==len && memcmp(stored,val,len)==0;
 }
 
 
@@ -157,28 +185,66 @@ void Nvm::put(int ix,const char*val) {
     Serial.printf("ERROR: index (%d) out of range (was the passed name valid?)\n",ix);
     return;
   }
-  int address = _fieldstarts[ix];
-  //Serial.printf("Nvm('%s')=EEPROM(%d) <- ",name,address);
+  _stats.puts++;
   // Determine string length
-  uint8_t sum = NVM_SUMINIT;
   unsigned len = strlen(val);
   if( len>_fields[ix].len ) len=_fields[ix].len; // truncate
-  EEPROM.write(address++, (uint8_t)len);
-  sum ^= len; // len is part of checksum
-  // Write all chars
-  uint8_t * p= (uint8_t*)val;
-  for(unsigned i=0; i<len; i++) {
-    EEPROM.write(address++,*p);
-    sum ^= *p;
-    p++;
-  }
-  // Write terminating zero (at 'len')
-  EEPROM.write(address++,'\0');
-  sum ^= '\0';
-  // Write checksum
-  EEPROM.write(address++,sum);
+  // Skip the write when the field already holds these bytes (so nothing changes, and nothing needs committing)
+  if( _equals(ix,val,len) ) { _stats.unchanged++; return; }
+#if NVM_LOG
+  // Append a record to the journal, and update the image
+  if( !_log.write(ix,val,len) ) { Serial.printf("ERROR: Nvm journal write of '%s' failed\n",_fields[ix].name); _failed=true; return; }
+  _set(_image+_fieldstarts[ix],val,len);
+#else
+  // Write into the RAM mirror (getDataPtr also marks it for commit)
+  _set(EEPROM.getDataPtr()+_fieldstarts[ix],val,len);
+  _dirty = true;
+#endif
   // Commit
-  EEPROM.commit();
+  if( !_transaction ) _commit();
+}
+
+
+// Writes len, the first 'len' chars of 'val', a terminating zero and the checksum to 'p'.
+void Nvm::_set(uint8_t*p,const char*val,unsigned len) {
+  uint8_t sum = NVM_SUMINIT ^ len; // len is part of checksum
+  *p++ = len;
+  for(unsigned i=0; i<len; i++) { *p++ = val[i]; sum ^= (uint8_t)val[i]; }
+  *p++ = '\0';
+  *p = sum;
+}
+
+
+// Starts a transaction: put()s are committed to flash by commit(), not each on its own.
+void Nvm::begin(void) {
+  _transaction = true;
+}
+
+
+// Ends the transaction: writes the flash sector, if any field changed.
+bool Nvm::commit(void) {
+  _transaction = false;
+  return _commit();
+}
+
+
+// Commits the changes (if any) to flash; each write erases and rewrites the EEPROM sector.
+bool Nvm::_commit(void) {
+  _stats.commits++;
+  if( _failed ) { _failed = false; return false; }
+  if( !_dirty ) return true;
+  _dirty = false;
+  _stats.erases++;
+  return EEPROM.commit();
+}
+
+
+// Returns the write statistics.
+const Nvm::Stats& Nvm::stats(void) {
+#if NVM_LOG
+  _stats.erases = _log.erases();
+#endif
+  return _stats;
 }
 
 
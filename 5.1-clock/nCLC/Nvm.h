@@ -3,30 +3,38 @@
 #define __NVM_H_
 /*
 REVISION HISTORY
+ v1.8.0  20261016  Typed fields (int, bool, enum, chars), zero-copy view() into the EEPROM
+ v1.7.0  20261016  Layout (offsets, checks, perfect hash for find) computed at compile time
+ v1.6.0  20261016  Optional wear-leveled journal backend (NVM_LOG)
+ v1.5.0  20261016  Transactions (begin/commit), unchanged fields are not written, write statistics
  v1.4.0  20220528  Extended max len to 128
  v1.3.0  20220430  Added NVM_VERSION
  v1.2.0  20200308  Allows len==0
  v1.1.0  20171029  Readme, license
  v1.0.0  20170417  Initial version
 */
-#define NVM_VERSION "1.4.0" // also in library.properties
+#define NVM_VERSION "1.8.0" // also in library.properties
 
 
 /*
   Define an nvm layout (a list of field names, field (default) values and field length) as follows:
-    static NvmField fields[] = {
+    constexpr NvmField fields[] = {
       {"ssid"    , "The ssid of the wifi AP"     , 32, 0},
       {"password", "The password of the wifi AP" , 32, 0},
       {0         , 0                             ,  0, 0}, // Mandatory sentinel
     };
   Then call the constructor
-    Nvm * nvm = new Nvm(fields);
+    Nvm * nvm = new Nvm(nvm_layout<fields>);
   or have it static
-    Nvm nvm(fields);
-  Note: Methods in this class print error conditions to Serial. Most notably, 
-  the constructor does a consistency check on the 'fields' and prints
-  any errors to Serial. This makes a static constructor less suitable, since 
-  the Serial port is not yet open.
+    Nvm nvm(nvm_layout<fields>);
+  The compiler computes the layout (the offset of each field in the EEPROM, and
+  a perfect hash table for find), and checks it: a too long name, len or default,
+  a duplicate name, or a bad sentinel fails the build with a static_assert.
+  Note: Methods in this class print (run-time) error conditions to Serial.
+
+  A field can be addressed by name (looked up via the hash table), by index, or by 
+  an index that the compiler looks up (which fails the build for an unknown name):
+    nvm->get(NVM_ID(fields,"ssid"),val);
 
   To store a value
     nvm->put("ssid","Something");
@@ -36,6 +44,26 @@ REVISION HISTORY
     nvm->get(name,val);
     Serial.printf("'%s' -> '%s'\n",name,val);
 
+  Every put() commits the EEPROM to flash, which erases and rewrites a flash sector. 
+  To save several fields with one sector write, put them in a transaction
+    nvm->begin();
+    nvm->put("ssid","Something");
+    nvm->put("password","Secret");
+    nvm->commit();
+  A put() of a value that is already stored does not write at all (also outside a transaction).
+  The number of puts, unchanged puts, commits, and actual sector writes is available via stats().
+
+  A field may have a type (by default it is any string up to len). For example
+      {"hours" , "24", 3, "The clock mode", nvm_enum("24|12")},
+      {"volume", "5" , 2, "The volume"    , nvm_int(0,10)},
+  The compiler checks that the default is a valid value. A stored value that is
+  not valid is replaced by the default. nvm_parse() validates a value and parses it
+  to a number (the int, 0 or 1 for a bool, the index in the list for an enum).
+
+  To read a value without copying it, view() returns a pointer into the EEPROM
+  (RAM mirror); it stays valid as long as the Nvm object.
+    const char * ssid = nvm->view(NVM_ID(fields,"ssid"));
+
   To inspect (hex dump) the EEPROM, call
     nvm->dump();
     
@@ -49,46 +77,221 @@ REVISION HISTORY
   
   Memory footprint is as follows: for each field, the EEPROM stores
   1 byte (for len), len (for data), 1 byte for the termination zero, and 1 byte a checksum.
+
+  With NVM_LOG set to 1, the fields are not stored in the EEPROM, but in a journal
+  (see NvmLog.h): a put() appends a small record, and the flash erases are spread
+  over several sectors. The API is the same; a commit() has nothing left to write.
 */
 
 
+#include <stdint.h>
+
+
 // Max buffer size (strlen+1) for values
 #define NVM_MAX_LENZ 129 
 
 
+// Storage backend: 0 for the EEPROM emulation, 1 for the wear-leveled journal
+#define NVM_LOG 0
+
+
+#if NVM_LOG
+  #include "NvmLog.h"
+#endif
+
+
+// The type of a field, determines which values are valid.
+#define NVM_STR   0 // Any string (up to len)
+#define NVM_INT   1 // A decimal integer in [min,max]
+#define NVM_BOOL  2 // "0" or "1"
+#define NVM_ENUM  3 // One of the words in list ('|' separated)
+#define NVM_CHARS 4 // Exactly len chars (each in list, if list is not 0), or empty
+struct NvmType {
+  uint8_t      kind;
+  int32_t      min;
+  int32_t      max;
+  const char * list;
+};
+constexpr NvmType nvm_str(void)                  { return { NVM_STR  , 0  , 0  , 0    }; }
+constexpr NvmType nvm_int(int32_t min,int32_t max){ return { NVM_INT  , min, max, 0    }; }
+constexpr NvmType nvm_bool(void)                 { return { NVM_BOOL , 0  , 1  , 0    }; }
+constexpr NvmType nvm_enum(const char*list)      { return { NVM_ENUM , 0  , 0  , list }; }
+constexpr NvmType nvm_chars(const char*list=0)   { return { NVM_CHARS, 0  , 0  , list }; }
+
+
 // An array of NvmField's defines the nvm layout; one NvmField defines a single field; it records:
 // the name of the field, its default value, and the max length of the value (i.e. the reserved space in the nvm)
-// A field has 'extra' which is not used by the Nvm module).
+// A field has 'extra' which is not used by the Nvm module), and a type (by default any string).
 class NvmField { 
   public:
-    NvmField( const char * _name, const char * _dft, unsigned int _len, const char* _extra) : name(_name), dft(_dft), len(_len), extra(_extra) {};
+    constexpr NvmField( const char * _name, const char * _dft, unsigned int _len, const char* _extra, NvmType _type=nvm_str()) : name(_name), dft(_dft), len(_len), extra(_extra), type(_type) {};
     const char *       name; // The name of the field.
     const char *       dft;  // Default value of the field (when not yet stored).
     const unsigned int len;  // Max strlen of value stored for name .
     const char *       extra;// Extra data (not used by Nvm module)
+    const NvmType      type; // Determines the valid values
 };
 
 
+// Returns true iff 'val' is a valid value for field 'f'; if so, stores the parsed value in 'num' 
+// (the int for NVM_INT, 0 or 1 for NVM_BOOL, the index in the list for NVM_ENUM, otherwise 0).
+constexpr bool nvm_parse(const NvmField&f,const char*val,int32_t*num) {
+  *num = 0;
+  unsigned len = 0;
+  while( val[len] ) len++;
+  if( len>f.len ) return false;
+  if( f.type.kind==NVM_INT ) {
+    bool neg = val[0]=='-';
+    unsigned i = neg ? 1 : 0;
+    if( i==len || len-i>9 ) return false; // No digits, or too many (for int32_t)
+    int32_t n = 0;
+    for( ; i<len; i++ ) { if( val[i]<'0' || val[i]>'9' ) return false; n = n*10 + (val[i]-'0'); }
+    *num = neg ? -n : n;
+    return f.type.min<=*num && *num<=f.type.max;
+  } else if( f.type.kind==NVM_BOOL ) {
+    *num = val[0]=='1';
+    return len==1 && (val[0]=='0' || val[0]=='1');
+  } else if( f.type.kind==NVM_ENUM ) {
+    const char * w = f.type.list; 
+    for( int32_t ix=0; ; ix++ ) { // Compare val with word ix in the list
+      unsigned i = 0;
+      while( i<len && w[i]==val[i] ) i++;
+      if( i==len && (w[i]=='|' || w[i]=='\0') ) { *num = ix; return true; }
+      while( *w && *w!='|' ) w++;
+      if( *w=='\0' ) return false;
+      w++;
+    }
+  } else if( f.type.kind==NVM_CHARS ) {
+    if( len!=0 && len!=f.len ) return false;
+    for( unsigned i=0; i<len && f.type.list!=0; i++ ) {
+      const char * c = f.type.list;
+      while( *c && *c!=val[i] ) c++;
+      if( *c=='\0' ) return false;
+    }
+  }
+  return true;
+}
+
+
+// Compile-time helpers for the layout (also usable at run-time).
+constexpr unsigned nvm_strlen(const char*s) { unsigned n=0; while( s[n] ) n++; return n; }
+constexpr bool     nvm_streq(const char*a,const char*b) { while( *a && *a==*b ) { a++; b++; } return *a==*b; }
+constexpr int      nvm_count(const NvmField*f) { int n=0; while( f[n].name ) n++; return n; }
+constexpr int      nvm_find(const NvmField*f,const char*name) { for( int ix=0; f[ix].name; ix++ ) if( nvm_streq(f[ix].name,name) ) return ix; return -1; }
+constexpr uint32_t nvm_hash(const char*s,uint32_t seed) { // FNV-1a, with the seed mixed into the offset basis
+  uint32_t h = 2166136261u ^ seed;
+  while( *s ) { h ^= (uint8_t)*s++; h *= 16777619u; }
+  return h ^ (h>>16);
+}
+
+
+// Layout checks (each returns true iff all fields pass).
+constexpr bool nvm_check_names(const NvmField*f) { 
+  for( int ix=0; f[ix].name; ix++ ) {
+    if( nvm_strlen(f[ix].name)>NVM_MAX_LENZ-1 ) return false;
+    if( nvm_find(f,f[ix].name)!=ix ) return false; // Duplicate
+  }
+  return true;
+}
+constexpr bool nvm_check_lens(const NvmField*f) { for( int ix=0; f[ix].name; ix++ ) if( f[ix].len>NVM_MAX_LENZ-1 ) return false; return true; }
+constexpr bool nvm_check_dfts(const NvmField*f) { for( int ix=0; f[ix].name; ix++ ) if( nvm_strlen(f[ix].dft)>f[ix].len ) return false; return true; }
+constexpr bool nvm_check_types(const NvmField*f) { for( int ix=0; f[ix].name; ix++ ) { int32_t num=0; if( !nvm_parse(f[ix],f[ix].dft,&num) ) return false; } return true; }
+constexpr bool nvm_check_sentinel(const NvmField*f) { int n=nvm_count(f); return f[n].dft==0 && f[n].len==0 && f[n].extra==0; }
+
+
+// The layout as used by Nvm at run-time; obtain it (for a constexpr 'fields') as nvm_layout<fields>.
+struct NvmLayout {
+  const NvmField* fields;                           // The field definitions (terminated by a sentinel).
+  int             count;                            // Number of fields (excluding the sentinel).
+  const uint16_t* starts;                           // For each field, its offset into the EEPROM; starts[count] is the EEPROM size.
+  const uint8_t*  slots;                            // Perfect hash table: slot nvm_hash(name,seed)&mask has the index of field 'name' (or 0xFF).
+  uint32_t        seed;
+  uint32_t        mask;
+};
+
+
+// Computes the tables of the layout at compile time.
+template<const NvmField*F> struct NvmTables {
+  static constexpr int      count = nvm_count(F);
+  static constexpr uint32_t size  = count<=4 ? 16 : count<=8 ? 32 : count<=16 ? 64 : count<=32 ? 128 : 256; // Power of 2, at least 4*count (so that a seed is found soon)
+  static_assert( NVM_MAX_LENZ-1<=255, "NVM_MAX_LENZ shall be max 256" );
+  static_assert( count<64, "Nvm layout has too many fields (max 63)" );
+  static_assert( nvm_check_names(F), "Nvm field has a name that exceeds NVM_MAX_LENZ-1, or a duplicate name" );
+  static_assert( nvm_check_lens(F), "Nvm field has a len that exceeds NVM_MAX_LENZ-1" );
+  static_assert( nvm_check_dfts(F), "Nvm field has a default that exceeds its len" );
+  static_assert( nvm_check_types(F), "Nvm field has a default that is not a valid value of its type" );
+  static_assert( nvm_check_sentinel(F), "Nvm sentinel field shall be all 0" );
+  struct Data { 
+    uint16_t starts[count+1]; 
+    uint8_t  slots[size]; 
+    uint32_t seed; 
+  };
+  static constexpr Data make(void) {
+    Data d{};
+    for( int ix=0; ix<count; ix++ ) d.starts[ix+1] = d.starts[ix] + 1+F[ix].len+1+1; // Add 1 byte for len, len bytes for content, 1 for terminating zero, and 1 for checksum
+    for( d.seed=0; d.seed<10000; d.seed++ ) { // Search a seed for which all names hash to a different slot
+      for( uint32_t s=0; s<size; s++ ) d.slots[s] = 0xFF;
+      int ix = 0;
+      while( ix<count && d.slots[nvm_hash(F[ix].name,d.seed)&(size-1)]==0xFF ) { d.slots[nvm_hash(F[ix].name,d.seed)&(size-1)] = ix; ix++; }
+      if( ix==count ) break;
+    }
+    return d;
+  }
+  static constexpr Data data = make();
+  static_assert( data.seed<10000, "Nvm layout has no perfect hash" );
+  static_assert( data.starts[count]<=4096, "Nvm layout exceeds the EEPROM (one flash sector)" );
+};
+template<const NvmField*F> constexpr NvmLayout nvm_layout = { F, NvmTables<F>::count, NvmTables<F>::data.starts, NvmTables<F>::data.slots, NvmTables<F>::data.seed, NvmTables<F>::size-1 };
+
+
+// The index of field 'name' in 'fields', looked up by the compiler.
+template<int IX> struct NvmId { static_assert( IX>=0, "Nvm layout has no field with this name" ); static constexpr int value = IX; };
+#define NVM_ID(fields,name) (NvmId<nvm_find(fields,name)>::value)
+
+
 // Wrapper class around the EEPROM to put and get strings into the EEPROM by name.
 // For each string the length, terminating zero and a checksum is also stored.
 // If a string is retrieved whose checksum is incorrect (e.g. when it was not 'put') the default value is returned.
 class Nvm {
   public: // main API functions
-    Nvm(NvmField*fields);                           // Constructor, passing the NVM layout.
+    Nvm(const NvmLayout&layout);                    // Constructor, passing the NVM layout (nvm_layout<fields>).
     ~Nvm(void);
     void     get(const char * name,char*val);       // Reads field 'name' from EEPROM and stores that in 'val'. Note 'val' must be allocated by user (size NVM_MAX_LENZ). 
     void     put(const char * name,const char*val); // Saves 'val' to field 'name' in EEPROM.
+    void     begin(void);                           // Starts a transaction: put()s are committed to flash by commit(), not each on its own.
+    bool     commit(void);                          // Ends the transaction: writes the flash sector, if any field changed. Returns false if the flash write failed.
   public: // helpers function
     void     dump(char * prefix=(char*)"  ");       // Dumps the nvm (used part of EEPROM) to serial port (each line is prefixed with 'prefix)'.
     int      count(void);                           // Returns the number of fields.
-    NvmField*field(int ix);                         // Returns field definition for field with index ix (or NULL if ix out of range).
-    int      find(const char * name);               // Looks up the field with name 'name' and return its index (returns -1 if name is not found).
-    void     get(int ix,char*val);                  // Reads field with index ix  from EEPROM and stores that in 'val'. Note 'val' must be allocated by user (size NVM_MAX_LENZ). 
+    const NvmField*field(int ix);                   // Returns field definition for field with index ix (or NULL if ix out of range).
+    int      find(const char * name);               // Looks up the field with name 'name' and return its index (returns -1 if name is not found). For a constant name, prefer NVM_ID.
+    void     get(int ix,char*val);                  // Reads field with index ix  from EEPROM and stores that in 'val'. Note 'val' must be allocated by user (size NVM_MAX_LENZ).
+    const char*view(int ix);                        // Returns field with index ix, without copying: a pointer into the EEPROM (or the default, when not validly stored). 
     void     put(int ix,const char*val);            // Saves 'val' to EEPROM, in field with index ix.
+    struct Stats {                                  // Write statistics (since construction)
+      uint32_t puts;                                // Number of put() calls
+      uint32_t unchanged;                           // Number of put() calls that did not change the field (so wrote nothing)
+      uint32_t commits;                             // Number of commits (explicit, or implicit by a put() outside a transaction)
+      uint32_t erases;                              // Number of flash sector erase+writes (a commit without changes does none)
+    };
+    const Stats& stats(void);                       // Returns the write statistics.
   private: // internal functions
-    NvmField*_fields;                               // The layout (the list of field definitions).
-    int*     _fieldstarts;                          // For each field, stores the offset into the EEPROM.
+    const NvmLayout*_layout;                        // The layout (computed at compile time).
+    const NvmField*_fields;                         // The list of field definitions (from _layout).
+    const uint16_t*_fieldstarts;                    // For each field, stores the offset into the EEPROM (from _layout).
     int      _fieldcount;                           // Number of fields (i.e. the length of the _fields array, excluding its terminator)
+    bool     _transaction;                          // A transaction is open (begin() without commit())
+    bool     _dirty;                                // The EEPROM (RAM mirror) has changes that are not yet committed
+    bool     _failed;                               // A journal write failed (reported by the next commit)
+#if NVM_LOG
+    NvmLog   _log;
+    uint8_t* _image;                                // The values from the journal, with the EEPROM layout
+#endif
+    Stats    _stats;
+    bool     _commit(void);                         // Commits the changes (if any) to flash
+    bool     _equals(int ix,const char*val,unsigned len); // Field ix holds the first len chars of val
+    const char*_stored(int ix);                     // The value stored for field ix (0 if the EEPROM bytes are not valid)
+    void     _set(uint8_t*p,const char*val,unsigned len); // Writes len, val, zero, and checksum to p
 };
 
 
@@ -0,0 +1,312 @@
+/*
+  NvmLog.cpp - Wear-leveled journal in flash, the alternative storage backend for Nvm
+*/
+
+
+#include <Arduino.h>
+#include "NvmLog.h"
+
+
+#define NVMLOG_MAGIC  0x314C564E // "NVL1", first word of an opened sector
+#define NVMLOG_HEADER 8          // Sector header: magic, seq
+#define NVMLOG_NONE   0xFFFF     // Index entry of an id without record
+#define NVMLOG_ERASED 0xFFFFFFFF
+#define NVMLOG_PAD(n) (((n)+3)&~3)
+
+
+// Flash access =============================================================
+// Offsets are relative to the journal; reads and writes are word aligned (as the SPI flash requires)
+
+
+#if NVMLOG_SIMULATE
+  // The simulated flash, and the number of erases and writes until a simulated power loss (-1 for none):
+  // the erase or write that uses up the budget is torn (only its first half is done), later ones fail
+  uint8_t nvmlog_flash[NVMLOG_SECTORS*NVMLOG_SECSIZE];
+  int     nvmlog_flash_budget = -1;
+  // Returns the number of bytes of an operation of 'size' bytes that are done before the power loss
+  static int nvmlog_flash_power(int size) {
+    if( nvmlog_flash_budget<0 ) return size;
+    if( nvmlog_flash_budget==0 ) return 0;
+    return --nvmlog_flash_budget==0 ? size/2 : size;
+  }
+  static bool nvmlog_flash_erase(int sector) {
+    int done = nvmlog_flash_power(NVMLOG_SECSIZE);
+    memset(&nvmlog_flash[sector*NVMLOG_SECSIZE], 0xFF, done);
+    return done==NVMLOG_SECSIZE;
+  }
+  static bool nvmlog_flash_write(uint32_t offset, const uint32_t*data, int size) {
+    int done = nvmlog_flash_power(size);
+    const uint8_t * p = (const uint8_t*)data;
+    for( int i=0; i<done; i++ ) nvmlog_flash[offset+i] &= p[i]; // NOR flash: a write only clears bits
+    return done==size;
+  }
+  static bool nvmlog_flash_read(uint32_t offset, uint32_t*data, int size) {
+    memcpy(data, &nvmlog_flash[offset], size);
+    return true;
+  }
+  static bool nvmlog_fits(void) {
+    return true;
+  }
+#else
+  // The journal takes the last NVMLOG_SECTORS sectors of the FS area; so the flash layout
+  // shall have an FS of at least that size, which is not mounted.
+  extern "C" uint32_t _FS_start;
+  extern "C" uint32_t _FS_end;
+  static uint32_t nvmlog_base(void) {
+    return ((uint32_t)&_FS_end - 0x40200000) - NVMLOG_SECTORS*NVMLOG_SECSIZE;
+  }
+  // Returns true iff the journal fits in the FS area (e.g. with FS:none it would overwrite the sketch or the OTA image)
+  static bool nvmlog_fits(void) {
+    return (uint32_t)&_FS_end - (uint32_t)&_FS_start >= NVMLOG_SECTORS*NVMLOG_SECSIZE;
+  }
+  static bool nvmlog_flash_erase(int sector) {
+    return ESP.flashEraseSector( nvmlog_base()/NVMLOG_SECSIZE + sector );
+  }
+  static bool nvmlog_flash_write(uint32_t offset, const uint32_t*data, int size) {
+    return ESP.flashWrite( nvmlog_base()+offset, (uint32_t*)data, size );
+  }
+  static bool nvmlog_flash_read(uint32_t offset, uint32_t*data, int size) {
+    return ESP.flashRead( nvmlog_base()+offset, data, size );
+  }
+#endif
+
+
+// Returns true iff all bytes of 'sector' are erased
+static bool nvmlog_blank(int sector) {
+  uint32_t words[16];
+  for( int pos=0; pos<NVMLOG_SECSIZE; pos+=sizeof(words) ) {
+    if( !nvmlog_flash_read(sector*NVMLOG_SECSIZE+pos, words, sizeof(words)) ) return false;
+    for( unsigned i=0; i<sizeof(words)/4; i++ ) if( words[i]!=NVMLOG_ERASED ) return false;
+  }
+  return true;
+}
+
+
+// CRC-16/CCITT (poly 0x1021, init 0xFFFF) over the record id, len, and data
+static uint16_t nvmlog_crc(int id, int len, const uint8_t*data) {
+  uint16_t crc = 0xFFFF;
+  for( int i=-2; i<len; i++ ) {
+    crc ^= (uint16_t)(i==-2 ? id : i==-1 ? len : data[i]) << 8;
+    for( int b=0; b<8; b++ ) crc = crc&0x8000 ? (crc<<1)^0x1021 : crc<<1;
+  }
+  return crc;
+}
+
+
+// Record buffer (header word followed by data), word aligned for the flash
+typedef union nvmlog_rec_u {
+  uint32_t words[1+NVMLOG_PAD(NVMLOG_MAXLEN)/4];
+  struct { uint8_t id; uint8_t len; uint16_t crc; uint8_t data[NVMLOG_PAD(NVMLOG_MAXLEN)]; } r;
+} nvmlog_rec_t;
+
+
+// Journal ==================================================================
+
+
+// Mounts the journal for ids 0..ids-1 (scans the sectors, recovers after power loss).
+bool NvmLog::begin(int ids) {
+  _ids = ids;
+  _index = new uint16_t[ids];
+  for( int id=0; id<ids; id++ ) _index[id] = NVMLOG_NONE;
+  _erases = 0;
+  _appends = 0;
+  _mounted = false;
+  if( !nvmlog_fits() ) {
+    Serial.printf("nvm : flash layout has no FS area of %d KB for the journal\n", NVMLOG_SECTORS*NVMLOG_SECSIZE/1024);
+    return false;
+  }
+  _mounted = _mount();
+  return _mounted;
+}
+
+
+// Scans the sectors and rebuilds the index; recovers after power loss.
+bool NvmLog::_mount(void) {
+  // Read the sector headers; erase the sectors that are neither opened nor blank (power loss during erase or open)
+  for( int s=0; s<NVMLOG_SECTORS; s++ ) {
+    uint32_t head[NVMLOG_HEADER/4];
+    if( !nvmlog_flash_read(s*NVMLOG_SECSIZE, head, NVMLOG_HEADER) ) return false;
+    _seq[s] = head[0]==NVMLOG_MAGIC && head[1]!=0 && head[1]!=NVMLOG_ERASED ? head[1] : 0;
+    if( _seq[s]==0 && !nvmlog_blank(s) ) {
+      Serial.printf("nvm : sector %d has bad header or is not blank, erased\n",s);
+      if( !_erase(s) ) return false;
+    }
+  }
+  _reindex();
+  if( _active<0 ) return _open(0,1); // Blank journal
+  for( int s=0; s<NVMLOG_SECTORS; s++ ) if( _seq[s]==0 ) return true;
+  // Power loss during compaction leaves no erased sector. The active sector then only holds copies
+  // from the oldest sector (the last one may be torn, which seals it), and the oldest is still intact;
+  // so redo the compaction into the active sector freshly erased.
+  Serial.printf("nvm : no erased sector, redoing compaction\n");
+  int target = _active;
+  uint32_t seq = _seq[target];
+  if( !_erase(target) ) return false;
+  _reindex();
+  if( !_open(target,seq) ) return false;
+  return _compact();
+}
+
+
+// Indexes the opened sectors from oldest to newest (so that later records supersede earlier ones); the newest is the active one.
+void NvmLog::_reindex(void) {
+  for( int id=0; id<_ids; id++ ) _index[id] = NVMLOG_NONE;
+  _active = -1;
+  uint32_t seq = 0;
+  for( ;; ) {
+    int next = -1;
+    for( int s=0; s<NVMLOG_SECTORS; s++ ) if( _seq[s]>seq && (next<0 || _seq[s]<_seq[next]) ) next=s;
+    if( next<0 ) break;
+    seq = _seq[next];
+    _active = next;
+    _pos = _scan(next);
+  }
+}
+
+
+// Releases the index.
+void NvmLog::end(void) {
+  delete[] _index;
+  _index = 0;
+}
+
+
+// Indexes the records of 'sector'; returns the offset after the last valid one.
+// A record with a bad crc (power loss during write) ends the scan, and seals the sector.
+int NvmLog::_scan(int sector) {
+  int pos = NVMLOG_HEADER;
+  while( pos+4<=NVMLOG_SECSIZE ) {
+    nvmlog_rec_t rec;
+    if( !nvmlog_flash_read(sector*NVMLOG_SECSIZE+pos, rec.words, 4) ) return NVMLOG_SECSIZE;
+    if( rec.words[0]==NVMLOG_ERASED ) return pos; // End of journal in this sector
+    int size = 4+NVMLOG_PAD(rec.r.len);
+    bool ok = rec.r.id<_ids && rec.r.len<=NVMLOG_MAXLEN && pos+size<=NVMLOG_SECSIZE
+           && nvmlog_flash_read(sector*NVMLOG_SECSIZE+pos+4, &rec.words[1], size-4)
+           && rec.r.crc==nvmlog_crc(rec.r.id,rec.r.len,rec.r.data);
+    if( !ok ) {
+      Serial.printf("nvm : sector %d has bad record at %d, sealed\n",sector,pos);
+      return NVMLOG_SECSIZE;
+    }
+    _index[rec.r.id] = sector*NVMLOG_SECSIZE+pos;
+    pos += size;
+  }
+  return pos;
+}
+
+
+bool NvmLog::_erase(int sector) {
+  _erases++;
+  _seq[sector] = 0;
+  return nvmlog_flash_erase(sector);
+}
+
+
+// Erases (if needed) 'sector' and makes it the active one.
+bool NvmLog::_open(int sector,uint32_t seq) {
+  uint32_t head[NVMLOG_HEADER/4];
+  if( !nvmlog_flash_read(sector*NVMLOG_SECSIZE, head, NVMLOG_HEADER) ) return false;
+  if( (head[0]!=NVMLOG_ERASED || head[1]!=NVMLOG_ERASED) && !_erase(sector) ) return false;
+  head[0] = NVMLOG_MAGIC;
+  head[1] = seq;
+  if( !nvmlog_flash_write(sector*NVMLOG_SECSIZE, head, NVMLOG_HEADER) ) return false;
+  _seq[sector] = seq;
+  _active = sector;
+  _pos = NVMLOG_HEADER;
+  return true;
+}
+
+
+// Opens the next erased sector, and compacts the oldest sector when that was the last erased one.
+bool NvmLog::_rollover(void) {
+  int next = -1;
+  for( int i=1; i<NVMLOG_SECTORS && next<0; i++ ) if( _seq[(_active+i)%NVMLOG_SECTORS]==0 ) next=(_active+i)%NVMLOG_SECTORS;
+  if( next<0 ) return false; // Not reached: compaction keeps one sector erased
+  if( !_open(next,_seq[_active]+1) ) return false;
+  for( int s=0; s<NVMLOG_SECTORS; s++ ) if( _seq[s]==0 ) return true; // There is still an erased sector
+  return _compact();
+}
+
+
+// Compacts the oldest sector: copies its records that are still the latest for their id to the active sector, then erases it.
+bool NvmLog::_compact(void) {
+  int oldest = -1;
+  for( int s=0; s<NVMLOG_SECTORS; s++ ) if( s!=_active && (oldest<0 || _seq[s]<_seq[oldest]) ) oldest=s;
+  for( int id=0; id<_ids; id++ ) {
+    if( _index[id]==NVMLOG_NONE || _index[id]/NVMLOG_SECSIZE!=oldest ) continue;
+    nvmlog_rec_t rec;
+    if( !nvmlog_flash_read(_index[id], rec.words, 4) ) return false;
+    if( !nvmlog_flash_read(_index[id]+4, &rec.words[1], NVMLOG_PAD(rec.r.len)) ) return false;
+    if( _pos+4+NVMLOG_PAD(rec.r.len)>NVMLOG_SECSIZE ) return false; // Live data of one sector fits in a newly opened one
+    if( !_append(id, rec.r.data, rec.r.len) ) return false;
+  }
+  return _erase(oldest);
+}
+
+
+// Appends to the active sector (the caller checks there is room).
+bool NvmLog::_append(int id,const uint8_t*data,int len) {
+  int size = 4+NVMLOG_PAD(len);
+  nvmlog_rec_t rec;
+  memset(&rec, 0xFF, size); // Padding stays erased
+  rec.r.id = id;
+  rec.r.len = len;
+  memcpy(rec.r.data, data, len);
+  rec.r.crc = nvmlog_crc(id,len,data);
+  uint32_t offset = _active*NVMLOG_SECSIZE+_pos;
+  _pos += size; // Also on failure: the bytes may be partially written
+  if( !nvmlog_flash_write(offset, rec.words, size) ) return false;
+  _index[id] = offset;
+  _appends++;
+  return true;
+}
+
+
+// Appends a record for 'id'.
+bool NvmLog::write(int id,const char*val,int len) {
+  if( !_mounted || id<0 || id>=_ids || len<0 || len>NVMLOG_MAXLEN ) return false;
+  // Each rollover either finds room, or compacts a sector; when all sectors are compacted the live data does not fit
+  for( int i=0; i<=NVMLOG_SECTORS; i++ ) {
+    if( _pos+4+NVMLOG_PAD(len)<=NVMLOG_SECSIZE ) return _append(id,(const uint8_t*)val,len);
+    if( !_rollover() ) return false;
+  }
+  Serial.printf("nvm : journal full\n");
+  return false;
+}
+
+
+// Reads the latest record of 'id' into 'val'. Returns its len, or -1 if there is none.
+int NvmLog::read(int id,char*val) {
+  if( !_mounted || id<0 || id>=_ids || _index[id]==NVMLOG_NONE ) return -1;
+  nvmlog_rec_t rec;
+  if( !nvmlog_flash_read(_index[id], rec.words, 4) ) return -1;
+  if( !nvmlog_flash_read(_index[id]+4, &rec.words[1], NVMLOG_PAD(rec.r.len)) ) return -1;
+  memcpy(val, rec.r.data, rec.r.len);
+  val[rec.r.len] = '\0';
+  return rec.r.len;
+}
+
+
+// Dumps the sectors and index to serial port.
+void NvmLog::dump(const char * prefix) {
+  if( !_mounted ) { Serial.printf("%snot mounted\n", prefix); return; }
+  for( int s=0; s<NVMLOG_SECTORS; s++ ) {
+    Serial.printf("%ssector %d: seq %u%s\n", prefix, s, _seq[s], s==_active?" (active)":_seq[s]==0?" (erased)":"");
+  }
+  Serial.printf("%sactive %d, free %d bytes, %u appends, %u erases\n", prefix, _active, NVMLOG_SECSIZE-_pos, _appends, _erases);
+  for( int id=0; id<_ids; id++ ) {
+    char val[NVMLOG_MAXLEN+1];
+    if( _index[id]==NVMLOG_NONE ) continue;
+    read(id,val);
+    Serial.printf("%s%04x %2d '%s'\n", prefix, _index[id], id, val);
+  }
+}
+
+
+uint32_t NvmLog::erases(void) {
+  return _erases;
+}
+
+
+uint32_t NvmLog::appends(void) {
+  return _appends;
+}
@@ -0,0 +1,77 @@
+//  NvmLog.h - Wear-leveled journal in flash, the alternative storage backend for Nvm
+#ifndef __NVMLOG_H_
+#define __NVMLOG_H_
+/*
+  The EEPROM emulation mirrors the whole layout in RAM, and every commit erases
+  and rewrites the same flash sector. NvmLog instead appends each field write as
+  a record to a journal spread over NVMLOG_SECTORS flash sectors, so a write costs
+  a few bytes, and the erases rotate over all sectors.
+
+  A sector starts with a header (magic, sequence number); the sector with the
+  highest sequence number is the active one, records are appended to it. A record is
+    id (1 byte), len (1 byte), crc (2 bytes, CRC-16/CCITT over id, len and data), data (len bytes, padded to 4)
+  A later record for an id supersedes earlier ones. In RAM, an index records the
+  flash offset of the latest record per id, so reads do not scan.
+
+  When the active sector is full, the next erased sector is opened. When that
+  leaves no erased sector, the oldest sector is compacted: its records that are
+  still the latest for their id are copied to the active sector, then it is erased.
+
+  At begin() the journal is scanned to rebuild the index. Power loss during a write
+  leaves a record with a bad crc (the previous record for that id stays valid); it
+  seals its sector (appending continues in the next). A sector with a bad header
+  (power loss during erase or open) is erased. Power loss during compaction leaves
+  no erased sector; the copies in the active sector are then erased, and the
+  compaction is redone from the oldest sector (which is only erased after it).
+
+  The journal takes the last NVMLOG_SECTORS sectors of the FS area of the flash
+  layout, so the layout shall have an FS of at least that size (which is then not
+  mounted); otherwise begin() fails, and nothing is written to flash.
+
+  Set NVMLOG_SIMULATE to 1 to replace the flash by a RAM array (with NOR semantics:
+  writes only clear bits, and with simulated power loss), e.g. to verify the backend
+  on a host (see host/nvmlog_test.cpp); erases() counts the sector erases in both cases.
+*/
+
+
+#include <stdint.h>
+
+
+#ifndef NVMLOG_SIMULATE
+#define NVMLOG_SIMULATE   0    // 1: the flash is simulated in RAM (host/nvmlog_test.cpp builds it with 1 on a PC)
+#endif
+#define NVMLOG_SECTORS    4    // Number of flash sectors for the journal (at most 16)
+#define NVMLOG_SECSIZE    4096 // Size of a flash sector (SPI_FLASH_SEC_SIZE)
+#define NVMLOG_MAXLEN     128  // Max length of record data (NVM_MAX_LENZ-1)
+
+
+class NvmLog {
+  public:
+    bool     begin(int ids);                        // Mounts the journal for ids 0..ids-1 (scans the sectors, recovers after power loss). Returns false on flash error, or when the flash layout has no room for it (then reads and writes fail).
+    void     end(void);                             // Releases the index.
+    int      read(int id,char*val);                 // Reads the latest record of 'id' into 'val' (zero terminated, size NVMLOG_MAXLEN+1). Returns its len, or -1 if there is none.
+    bool     write(int id,const char*val,int len);  // Appends a record for 'id'. Returns false if the journal is full or the flash write failed.
+    void     dump(const char * prefix);             // Dumps the sectors and index to serial port.
+    uint32_t erases(void);                          // Number of sector erases (since begin).
+    uint32_t appends(void);                         // Number of records appended (since begin, including those copied by compaction).
+  private:
+    bool     _mounted;                              // begin() succeeded
+    int      _ids;                                  // Number of ids
+    uint16_t*_index;                                // For each id, the flash offset of its latest record (NVMLOG_NONE if none)
+    uint32_t _seq[NVMLOG_SECTORS];                  // Sequence number per sector (0 for an erased sector)
+    int      _active;                               // Sector records are appended to
+    int      _pos;                                  // Offset in _active of the first free byte
+    uint32_t _erases;
+    uint32_t _appends;
+    bool     _mount(void);                          // Scans the sectors and rebuilds the index; recovers after power loss
+    void     _reindex(void);                        // Indexes the opened sectors from oldest to newest; the newest is the active one
+    bool     _open(int sector,uint32_t seq);        // Erases (if needed) 'sector' and makes it the active one
+    bool     _erase(int sector);
+    bool     _append(int id,const uint8_t*data,int len); // Appends to the active sector (no rollover, the caller checks there is room)
+    bool     _rollover(void);                       // Opens the next erased sector, and compacts the oldest if none is left
+    bool     _compact(void);                        // Copies the live records of the oldest sector to the active one, and erases it
+    int      _scan(int sector);                     // Indexes the records of 'sector'; returns the offset after the last valid one
+};
+
+
+#endif
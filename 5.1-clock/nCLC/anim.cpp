@@ -0,0 +1,88 @@
+// anim.cpp - keyframe animations on the 303WIFILC01 display
+
+#include <Arduino.h>
+#include "disp.h"
+#include "anim.h"
+
+const AnimSeq* DispAnim::table;
+const AnimSeq* DispAnim::seq;
+uint8_t        DispAnim::frame;
+uint16_t       DispAnim::left;
+
+void DispAnim::init(const AnimSeq* seqs)
+{
+    table = seqs;
+    seq = 0;
+    Disp303::setAnimator(tick);
+    int n = 0;
+    while (pgm_read_byte(&seqs[n].name[0])) n++;
+    Serial.printf("anim: init %d sequences\n", n);
+}
+
+// Returns the sequence (in flash) named `name`, or 0 if there is none
+const AnimSeq* DispAnim::find(const char* name)
+{
+    if (!table || !*name) return 0;
+    for (const AnimSeq* s = table; pgm_read_byte(&s->name[0]); s++)
+        if (strncmp_P(name, s->name, ANIM_NAMELEN) == 0) return s;
+    return 0;
+}
+
+// Publishes frame `f` of sequence `s`, and starts its timer
+void DispAnim::show(const AnimSeq* s, uint8_t f)
+{
+    const AnimFrame* frames = (const AnimFrame*)pgm_read_ptr(&s->frames);
+    uint32_t segs = 0;
+    for (uint8_t d = 0; d < 4; d++) segs |= (uint32_t)pgm_read_byte(&frames[f].segs[d]) << (8 * d);
+    Disp303::setFrame(segs, pgm_read_byte(&frames[f].mask));
+    frame = f;
+    left = pgm_read_word(&frames[f].ms);
+}
+
+bool DispAnim::start(const char* name)
+{
+    const AnimSeq* s = find(name);
+    if (!s || pgm_read_byte(&s->count) == 0) { Serial.printf("anim: unknown '%s'\n", name); return false; }
+    seq = s;
+    show(s, 0);
+    return true;
+}
+
+void DispAnim::stop()
+{
+    seq = 0;
+}
+
+bool DispAnim::seek(const char* name, uint8_t f)
+{
+    seq = 0;
+    const AnimSeq* s = find(name);
+    if (!s || f >= pgm_read_byte(&s->count)) return false;
+    show(s, f);
+    return true;
+}
+
+bool DispAnim::running()
+{
+    return seq != 0;
+}
+
+// Called by the refresher every `ms`: advances to the next frame when the current one is due,
+// and after the last frame chains to the next sequence (or stops)
+void DispAnim::tick(uint8_t ms)
+{
+    if (!seq || !left) return;
+    if (left > ms) { left -= ms; return; }
+    uint8_t f = frame + 1;
+    if (f >= pgm_read_byte(&seq->count))
+    {
+        char next[ANIM_NAMELEN];
+        memcpy_P(next, seq->next, ANIM_NAMELEN);
+        next[ANIM_NAMELEN - 1] = '\0';
+        seq = find(next);
+        if (seq && !pgm_read_byte(&seq->count)) seq = 0;
+        if (!seq) return; // ended, the last frame stays
+        f = 0;
+    }
+    show(seq, f);
+}
@@ -0,0 +1,59 @@
+// anim.h - interface for the keyframe animations on the 303WIFILC01 display
+#ifndef _ANIM_H_
+#define _ANIM_H_
+
+#include <Arduino.h> // PROGMEM
+
+/*
+  An animation is a sequence of frames in flash, played by the display refresher (see Disp303::setAnimator),
+  so it takes no heap and no work in loop(). Define the sequences in a table terminated by an empty name:
+    static const AnimFrame spin[] PROGMEM = {
+      { {0, 0, 0, SEG_A}, 0b1000, 250 },
+      { {0, 0, 0, SEG_B}, 0b1000, 250 },
+    };
+    static const AnimSeq seqs[] PROGMEM = {
+      { "spin", spin, ANIM_COUNT(spin), "spin" }, // chains to itself: loops
+      { ""    , 0   , 0               , ""     }, // Mandatory sentinel
+    };
+  Then call DispAnim::init(seqs) (after Disp303::init) and DispAnim::start("spin").
+*/
+
+#define ANIM_NAMELEN   8 // Size of a sequence name (including terminating zero)
+#define ANIM_COUNT(fs) ((uint8_t)(sizeof(fs) / sizeof((fs)[0])))
+
+struct AnimFrame
+{
+    uint8_t  segs[4]; // Segments (nCLCsegs) per digit, digit 0 is the left-most
+    uint8_t  mask;    // Bit d set: digit d is taken from segs, the others keep what show() put there
+    uint16_t ms;      // Time the frame is shown (rounded up to the refresh period); 0 holds the frame
+};
+
+struct AnimSeq
+{
+    char             name[ANIM_NAMELEN];
+    const AnimFrame* frames;
+    uint8_t          count;
+    char             next[ANIM_NAMELEN]; // Sequence that is started after the last frame, "" to stop
+};
+
+class DispAnim
+{
+public:
+    static void init(const AnimSeq* seqs);                 // Installs the table (in flash) and hooks into the refresher
+    static bool start(const char* name);                   // Plays sequence `name` from its first frame; false if unknown
+    static void stop();                                    // Stops playing; the display keeps the current frame
+    static bool seek(const char* name, uint8_t frame);     // Stops playing and shows `frame` of `name` (e.g. progress)
+    static bool running();                                 // A sequence is playing (not stopped, ended, or seeked)
+
+private:
+    static void tick(uint8_t ms);
+    static const AnimSeq* find(const char* name);
+    static void show(const AnimSeq* seq, uint8_t frame);
+
+    static const AnimSeq*    table;   // Sequences (flash)
+    static const AnimSeq*    seq;     // Sequence playing (flash), 0 if none
+    static uint8_t           frame;   // Frame of seq on the display
+    static uint16_t          left;    // Time left for frame (ms), 0 holds it
+};
+
+#endif
@@ -2,6 +2,8 @@
 #ifndef _DISP_H_
 #define _DISP_H_
 
+#include "tm1650.h"
+
 // https://datasheet.lcsc.com/lcsc/1810281208_TM-Shenzhen-Titan-Micro-Elec-TM1650_C44444.pdf
 
 /*
@@ -45,11 +47,12 @@ enum nCLCsegs : uint8_t {
 class Disp303
 {
 private:
-    enum Disp303TM1650pins : int8_t { SCL_PIN = 12, SDA_PIN = 13 };
+    enum : uint32_t { CLOCK_HZ = 400000 }; // Clock of the TM1650 bus (tm1650.cpp drives GPIO12/13)
     enum TM1650reg : uint8_t { 
-        TM1650_CONTROL_BASE = 0x24,	// Address of the control register of the left-most digit
-        TM1650_DISPLAY_BASE	= 0x34	// Address of the left-most digit
+        TM1650_CONTROL_BASE = TM1650_CONTROL,	// Address of the control register of the left-most digit
+        TM1650_DISPLAY_BASE	= TM1650_DIGIT1	// Address of the left-most digit (next digits at +2)
     };
+    enum : uint8_t { REFRESH_MS = 10 }; // Period of the refresher
 public:
     Disp303(int bright = 4, bool segmode = false, bool power = false);
     void init();
@@ -60,12 +63,40 @@ public:
     bool getPower() const;
     void setMode(bool segmode = false);
     bool getMode() const;
+    // Producers: show() and setDigit() compose the next frame in a back buffer and publish it as a whole (one 32-bit
+    // store) to the front buffer. They never touch the bus, so they may be called from loop() and from a Ticker.
     static void show(const char* s, uint8_t dots = 0);
     IRAM_ATTR static void setDigit(uint8_t d, uint8_t segs);
+    // Publishes the digits of `segs` (digit d in byte d) for which bit d of `mask` is set; the others are kept.
+    IRAM_ATTR static void setFrame(uint32_t segs, uint8_t mask);
+    // Installs `tick` (0 to remove), which the refresher calls before sending, with the time since its previous run (ms).
+    // It typically is a producer, see anim.h.
+    static void setAnimator(void (*tick)(uint8_t ms));
+
+    // The refresher (a Ticker started by init(), every REFRESH_MS) is the only user of the bus: it sends the digits
+    // of the front buffer that differ from what is on the display (a failed one is retried), and the control register
+    // when it changed. So display latency does not depend on how long loop() takes.
+    struct Stats
+    {
+        uint32_t frames;    // Number of frames published
+        uint32_t refreshes; // Number of refresher runs
+        uint32_t writes;    // Number of registers actually sent
+    };
+    static const Stats& getStats();
 
 private:
     IRAM_ATTR static uint8_t write(uint8_t reg, uint8_t val);
-    static const uint8_t dispFont[0x80] ;
+    IRAM_ATTR static void refresh();
+    void publishControl();
+
+    static uint32_t          back;      // Frame being composed by the producers (digit d in byte d)
+    static volatile uint32_t front;     // Last published frame
+    static uint32_t          shown;     // Frame on the display
+    static uint8_t           dirty;     // Bit d set: digit d of the display is unknown (so it is sent, even if equal)
+    static volatile uint8_t  controlReq;// Control byte requested (published settings)
+    static int16_t           control;   // Control byte last sent, -1 if unknown
+    static Stats             stats;
+    static void            (*animator)(uint8_t ms);
 
     union DispSettings
     {
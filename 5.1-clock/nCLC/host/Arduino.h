@@ -0,0 +1,20 @@
+// Arduino.h - the part of the ESP8266 core used by NvmLog.cpp, so that it builds on a PC (see nvmlog_test.cpp)
+#ifndef _HOST_ARDUINO_H_
+#define _HOST_ARDUINO_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+class HardwareSerial {
+  public:
+    bool quiet = false; // Drops the output (the power loss test mounts the journal thousands of times)
+    size_t printf(const char * format, ...) __attribute__((format(printf,2,3))) {
+      if( quiet ) return 0;
+      va_list args; va_start(args,format); int n=vprintf(format,args); va_end(args); return n;
+    }
+};
+extern HardwareSerial Serial;
+
+#endif
@@ -0,0 +1,173 @@
+// nvmlog_test.cpp - tests the journal (NvmLog) on a PC, with the flash simulated in RAM (NVMLOG_SIMULATE)
+//
+// This folder is not part of the sketch (the Arduino IDE only compiles the sketch folder itself, and src/).
+// Build and run from the sketch folder with
+//   g++ -O2 -Ihost -I. -DNVMLOG_SIMULATE=1 NvmLog.cpp host/nvmlog_test.cpp -o nvmlog_test && ./nvmlog_test
+// The last test cuts the power at every flash erase and write of a run that rolls over and compacts all sectors,
+// and checks that the journal then mounts, has the old or the new value for each id, and can be written.
+
+#include <Arduino.h>
+#include <string>
+#include "../NvmLog.h"
+
+
+HardwareSerial Serial;
+extern uint8_t nvmlog_flash[NVMLOG_SECTORS*NVMLOG_SECSIZE];
+extern int     nvmlog_flash_budget;
+
+
+#define IDS 10
+static int test_fails;
+
+#define CHECK(cond,...) do { if( !(cond) ) { test_fails++; printf("FAIL %s:%d ",__FILE__,__LINE__); printf(__VA_ARGS__); printf("\n"); } } while(0)
+
+
+// Returns the value 'n' of the run for 'id' (lengths vary, so the sectors fill unevenly)
+static std::string test_val(int id, int n) {
+  char buf[NVMLOG_MAXLEN+1];
+  snprintf(buf, sizeof(buf), "%d-%d-", id, n);
+  std::string s(buf);
+  s.append( ((n+1)*7+id)%40, 'a'+(n+1)%26 );
+  return s;
+}
+
+
+// Returns the value of 'id' in 'log', or "(none)"
+static std::string test_read(NvmLog & log, int id) {
+  char val[NVMLOG_MAXLEN+1];
+  return log.read(id,val)<0 ? "(none)" : val;
+}
+
+
+static void test_blank(void) {
+  memset(nvmlog_flash, 0xFF, sizeof(nvmlog_flash));
+  NvmLog log;
+  CHECK( log.begin(IDS), "blank mount" );
+  CHECK( test_read(log,3)=="(none)", "blank read" );
+  CHECK( log.write(3,"hello",5) && log.write(4,"",0), "write" );
+  CHECK( test_read(log,3)=="hello" && test_read(log,4)=="", "read back" );
+  log.end();
+  CHECK( log.begin(IDS) && test_read(log,3)=="hello" && test_read(log,4)=="", "remount" );
+  log.end();
+  printf("blank  : done\n");
+}
+
+
+static void test_wear(void) {
+  memset(nvmlog_flash, 0xFF, sizeof(nvmlog_flash));
+  NvmLog log;
+  CHECK( log.begin(IDS), "mount" );
+  std::string big(NVMLOG_MAXLEN,'t');
+  for( int n=0; n<5000; n++ ) {
+    CHECK( log.write(0,test_val(0,n).c_str(),test_val(0,n).size()), "write %d",n );
+    if( n%50==0 ) { big[0]='a'+n%26; CHECK( log.write(1,big.c_str(),big.size()), "write big %d",n ); }
+  }
+  printf("wear   : 5000+100 writes, %u appends, %u erases\n", log.appends(), log.erases());
+  log.end();
+  CHECK( log.begin(IDS), "remount" );
+  CHECK( test_read(log,0)==test_val(0,4999) && test_read(log,1)==big, "remount values" );
+  log.end();
+}
+
+
+static void test_torn(void) {
+  memset(nvmlog_flash, 0xFF, sizeof(nvmlog_flash));
+  NvmLog log;
+  CHECK( log.begin(IDS) && log.write(2,"before",6) && log.write(2,"torn-rec",8), "write" );
+  log.end();
+  int at = -1;
+  for( int i=0; i+8<=(int)sizeof(nvmlog_flash); i++ ) if( memcmp(&nvmlog_flash[i],"torn-rec",8)==0 ) at=i;
+  nvmlog_flash[at+3] &= 0x0F; // Corrupt the data of the last record
+  CHECK( log.begin(IDS) && test_read(log,2)=="before", "previous value after torn record" );
+  CHECK( log.write(2,"next",4) && test_read(log,2)=="next", "write after torn record" );
+  log.end();
+  CHECK( log.begin(IDS) && test_read(log,2)=="next", "remount after torn record" );
+  log.end();
+  printf("torn   : done\n");
+}
+
+
+static void test_header(void) {
+  memset(nvmlog_flash, 0xFF, sizeof(nvmlog_flash));
+  NvmLog log;
+  CHECK( log.begin(IDS) && log.write(5,"kept",4), "write" );
+  log.end();
+  nvmlog_flash[2*NVMLOG_SECSIZE+100] = 0; // A not-blank erased sector (power loss during erase)
+  CHECK( log.begin(IDS) && test_read(log,5)=="kept", "mount with bad sector" );
+  log.end();
+  CHECK( nvmlog_flash[2*NVMLOG_SECSIZE+100]==0xFF, "bad sector erased" );
+  printf("header : done\n");
+}
+
+
+// The run for the power loss test: writes to ids 0..7, rarely to 8, never to 9 (so compaction has live records to copy)
+#define RUN 700
+static int test_run_id(int n) { return n%100==99 ? 8 : n%8; }
+
+
+// Checks that 'log' has the values of the run up to write 'n' (which may or may not have been done)
+static void test_values(NvmLog & log, int n, int budget) {
+  for( int id=0; id<IDS; id++ ) {
+    std::string old = test_val(id,-1);
+    for( int i=0; i<n; i++ ) if( test_run_id(i)==id ) old = test_val(id,i);
+    std::string val = test_read(log,id);
+    bool ok = val==old || (n<RUN && test_run_id(n)==id && val==test_val(id,n));
+    CHECK( ok, "budget %d, write %d: id %d is '%s', expected '%s'", budget, n, id, val.c_str(), old.c_str() );
+  }
+}
+
+
+static void test_power(void) {
+  static uint8_t start[sizeof(nvmlog_flash)], lost[sizeof(nvmlog_flash)];
+  NvmLog log;
+  memset(nvmlog_flash, 0xFF, sizeof(nvmlog_flash));
+  CHECK( log.begin(IDS), "mount" );
+  for( int id=0; id<IDS; id++ ) log.write(id, test_val(id,-1).c_str(), test_val(id,-1).size());
+  log.end();
+  memcpy(start, nvmlog_flash, sizeof(start));
+  // Count the flash operations of the run
+  CHECK( log.begin(IDS), "mount" );
+  nvmlog_flash_budget = 1000000;
+  for( int n=0; n<RUN; n++ ) log.write(test_run_id(n), test_val(test_run_id(n),n).c_str(), test_val(test_run_id(n),n).size());
+  int ops = 1000000-nvmlog_flash_budget;
+  uint32_t erases = log.erases();
+  nvmlog_flash_budget = -1;
+  log.end();
+  // Cut the power at each of them, then also during the recovery
+  Serial.quiet = true;
+  int fails = test_fails;
+  for( int budget=1; budget<=ops; budget++ ) {
+    memcpy(nvmlog_flash, start, sizeof(start));
+    log.begin(IDS);
+    nvmlog_flash_budget = budget;
+    int n = 0;
+    while( n<RUN && log.write(test_run_id(n), test_val(test_run_id(n),n).c_str(), test_val(test_run_id(n),n).size()) ) n++;
+    nvmlog_flash_budget = -1;
+    log.end();
+    memcpy(lost, nvmlog_flash, sizeof(lost));
+    for( int again=0; again<=8; again++ ) {
+      memcpy(nvmlog_flash, lost, sizeof(lost));
+      if( again>0 ) { nvmlog_flash_budget = again; log.begin(IDS); nvmlog_flash_budget = -1; log.end(); }
+      CHECK( log.begin(IDS), "budget %d/%d: mount", budget, again );
+      test_values(log, n, budget);
+      for( int id=0; id<IDS; id++ ) CHECK( log.write(id,"after",5) && test_read(log,id)=="after", "budget %d/%d: write id %d", budget, again, id );
+      log.end();
+      CHECK( log.begin(IDS) && test_read(log,IDS-1)=="after", "budget %d/%d: remount", budget, again );
+      log.end();
+      if( test_fails-fails>20 ) { Serial.quiet = false; printf("power  : too many failures, stopped\n"); return; }
+    }
+  }
+  Serial.quiet = false;
+  printf("power  : %d writes (%u erases), power lost at each of %d flash operations and at 8 during recovery\n", RUN, erases, ops);
+}
+
+
+int main() {
+  test_blank();
+  test_wear();
+  test_torn();
+  test_header();
+  test_power();
+  printf("%s (%d failures)\n", test_fails ? "FAILED" : "passed", test_fails);
+  return test_fails ? 1 : 0;
+}
@@ -9,17 +9,16 @@
 #include "led.h"
 #include "but.h"
 #include "disp.h"
+#include "anim.h"
 #include "wifi.h"
 
-#include <Ticker.h>
-
 #include <ESP8266mDNS.h>
 #include <WiFiUdp.h>
 #include <ArduinoOTA.h>
 #define OTA_PASSWORD "IoTOTA"
 #define OTA_TIMEOUT 900000
 
-NvmField cfg_fields[] = {
+constexpr NvmField cfg_fields[] = {
   {"Access points"   , ""                           ,  0, "The clock uses internet to get time. Supply credentials for one or more WiFi access points (APs). " },
   {"Ssid.1"          , "SSID for AP1"               , 32, "The ssid of the first wifi network the clock could connect to (mandatory)." },
   {"Password.1"      , "Password for AP1"           , 32, "The password of the first wifi network the clock could connect to (mandatory). "},
@@ -35,8 +34,8 @@ NvmField cfg_fields[] = {
   {"Timezone"        , "CET-1CEST,M3.5.0,M10.5.0/3" , 48, "The timezone string (including daylight saving), see <A href='https://www.gnu.org/software/libc/manual/html_node/TZ-Variable.html'>details</A>. " },
 
   {"Rendering"       , ""                           ,  0, "Determines how time and date is shown on the display. " },
-  {"hours"           , "24"                         ,  3, "Use <b>24</b> or <b>12</b> for 24 or 12 hour clock; append <b>a</b> or <b>p</b> to use decimal point for am or pm." },
-  {"dateorder"       , "d"                          ,  2, "Use <b>d</b> for day-month (europe) or <b>m</b> month-day (US) order." },
+  {"hours"           , "24"                         ,  3, "Use <b>24</b> or <b>12</b> for 24 or 12 hour clock; append <b>a</b> or <b>p</b> to use decimal point for am or pm.", nvm_enum("24|24a|24p|12|12a|12p") },
+  {"dateorder"       , "d"                          ,  2, "Use <b>d</b> for day-month (europe) or <b>m</b> month-day (US) order.", nvm_enum("d|m") },
   {"monthnames"      , "JaFeMrApMYJnJlAuSeOcNoDe"   , 24, "Supply 12 pairs of letters for month names, otherwise month will be numbered." },
 
   {0                 , 0                            ,  0, 0},  
@@ -45,7 +44,8 @@ NvmField cfg_fields[] = {
 
 #define CFG_BUT_PIN 0 // Button to select Config mode (mapped to the SET button)
 #define CFG_LED_PIN 2 // LED to indicate Config mode (mapped to the (only) LED on the board
-Cfg cfg("nCLC", cfg_fields, CFG_SERIALLVL_USR, CFG_LED_PIN);
+Cfg cfg("nCLC", nvm_layout<cfg_fields>, CFG_SERIALLVL_USR, CFG_LED_PIN);
+#define CFG_ID(name) NVM_ID(cfg_fields,name) // Index of field 'name', looked up by the compiler
 
 int render_hours_len; // 12 or 24
 #define RENDER_FLAG_AM 0
@@ -57,20 +57,44 @@ int render_dayfirst;
 const char * render_months=" 1 2 3 4 5 6 7 8 9101112";
 bool ota_on = true;
 bool sync = false;
+bool synced = false; // sync was seen (the sync animation was started)
 
-Ticker dispTick;
-bool animRunning;
 Disp303 disp;
 
-IRAM_ATTR void dispNextFrame()
-{
-    static int frame = 0;
-    static const uint8_t ani[] = { SEG_A, SEG_B, SEG_C, SEG_D, SEG_E, SEG_F, 0 };
-
-    disp.setDigit(3, ani[frame++]);
-    if (!ani[frame])
-        frame = 0;
-}
+// Animations (played by the display refresher, see anim.h)
+#define SEG_HALF ( SEG_E | SEG_F )                 // 'I'
+#define SEG_FULL ( SEG_B | SEG_C | SEG_E | SEG_F ) // 'X'
+static const AnimFrame anim_ntp[] PROGMEM = { // spinner on the last digit, while waiting for NTP
+    { {0, 0, 0, SEG_A}, 0b1000, 250 },
+    { {0, 0, 0, SEG_B}, 0b1000, 250 },
+    { {0, 0, 0, SEG_C}, 0b1000, 250 },
+    { {0, 0, 0, SEG_D}, 0b1000, 250 },
+    { {0, 0, 0, SEG_E}, 0b1000, 250 },
+    { {0, 0, 0, SEG_F}, 0b1000, 250 },
+};
+static const AnimFrame anim_sync[] PROGMEM = { // dash sweeping over the display, when NTP time arrives
+    { {SEG_G, 0, 0, 0}, 0b1111, 80 },
+    { {0, SEG_G, 0, 0}, 0b1111, 80 },
+    { {0, 0, SEG_G, 0}, 0b1111, 80 },
+    { {0, 0, 0, SEG_G}, 0b1111, 80 },
+};
+static const AnimFrame anim_ota[] PROGMEM = { // OTA progress bar in eighths, selected with DispAnim::seek()
+    { {0,        0,        0,        0       }, 0b1111, 0 },
+    { {SEG_HALF, 0,        0,        0       }, 0b1111, 0 },
+    { {SEG_FULL, 0,        0,        0       }, 0b1111, 0 },
+    { {SEG_FULL, SEG_HALF, 0,        0       }, 0b1111, 0 },
+    { {SEG_FULL, SEG_FULL, 0,        0       }, 0b1111, 0 },
+    { {SEG_FULL, SEG_FULL, SEG_HALF, 0       }, 0b1111, 0 },
+    { {SEG_FULL, SEG_FULL, SEG_FULL, 0       }, 0b1111, 0 },
+    { {SEG_FULL, SEG_FULL, SEG_FULL, SEG_HALF}, 0b1111, 0 },
+    { {SEG_FULL, SEG_FULL, SEG_FULL, SEG_FULL}, 0b1111, 0 },
+};
+static const AnimSeq anim_seqs[] PROGMEM = {
+    { "ntp"  , anim_ntp , ANIM_COUNT(anim_ntp) , "ntp" }, // loops
+    { "sync" , anim_sync, ANIM_COUNT(anim_sync), ""    },
+    { "ota"  , anim_ota , ANIM_COUNT(anim_ota) , ""    },
+    { ""     , 0        , 0                    , ""    },
+};
 
 void setup() {
   Serial.begin(115200);
@@ -98,6 +122,7 @@ void setup() {
   disp.init();
   disp.setPower();
   disp.show("nClC");
+  DispAnim::init(anim_seqs);
 
   // On boot: check if config button is pressed
   cfg.check(100,CFG_BUT_PIN); // Wait 100 flashes (of 50ms) for a change on pin CFG_BUT_PIN
@@ -112,23 +137,21 @@ void setup() {
 
   // Preprocess config for rendering
   disp.show("NtP");
-  dispTick.attach_ms(250, dispNextFrame);
-  animRunning = true;
+  DispAnim::start("ntp");
 
-  if( cfg.getval("hours")[0]=='1' && cfg.getval("hours")[1]=='2' ) render_hours_len=12; else render_hours_len=24;
-  if( cfg.getval("hours")[2]=='a' ) render_hours_flag = RENDER_FLAG_AM;
-  else if( cfg.getval("hours")[2]=='p' ) render_hours_flag = RENDER_FLAG_PM;
-  else render_hours_flag = RENDER_FLAG_NO;
+  int hours = cfg.getnum(CFG_ID("hours")); // Index in 24|24a|24p|12|12a|12p
+  render_hours_len = hours<3 ? 24 : 12;
+  render_hours_flag = hours%3==1 ? RENDER_FLAG_AM : hours%3==2 ? RENDER_FLAG_PM : RENDER_FLAG_NO;
   Serial.printf("rend: hours %d, flag %s\n",render_hours_len, render_hours_flag_names[render_hours_flag]);
-  render_dayfirst = cfg.getval("dateorder")[0]!='m';
-  if( strlen(cfg.getval("monthnames"))==24 ) render_months=cfg.getval("monthnames");
+  render_dayfirst = cfg.getnum(CFG_ID("dateorder"))==0; // Index in d|m
+  if( strlen(cfg.getval(CFG_ID("monthnames")))==24 ) render_months=cfg.getval(CFG_ID("monthnames")); // Any other length: numbered months
   Serial.printf("rend: date %s, names '%s'\n",render_dayfirst?"day:month":"month:day",render_months);
 
   // WiFi and NTP
-  wifi_init(cfg.getval("Ssid.1"),cfg.getval("Password.1"), cfg.getval("Ssid.2"),cfg.getval("Password.2"), cfg.getval("Ssid.3"),cfg.getval("Password.3"));
-  configTime( cfg.getval("Timezone"), cfg.getval("NTP.server.1"), cfg.getval("NTP.server.2"), cfg.getval("NTP.server.3"));
-  Serial.printf("clk : init: %s %s %s\n", cfg.getval("NTP.server.1"), cfg.getval("NTP.server.2"), cfg.getval("NTP.server.3"));
-  Serial.printf("clk : timezone: %s\n", cfg.getval("Timezone") );
+  wifi_init(cfg.getval(CFG_ID("Ssid.1")),cfg.getval(CFG_ID("Password.1")), cfg.getval(CFG_ID("Ssid.2")),cfg.getval(CFG_ID("Password.2")), cfg.getval(CFG_ID("Ssid.3")),cfg.getval(CFG_ID("Password.3")));
+  configTime( cfg.getval(CFG_ID("Timezone")), cfg.getval(CFG_ID("NTP.server.1")), cfg.getval(CFG_ID("NTP.server.2")), cfg.getval(CFG_ID("NTP.server.3")));
+  Serial.printf("clk : init: %s %s %s\n", cfg.getval(CFG_ID("NTP.server.1")), cfg.getval(CFG_ID("NTP.server.2")), cfg.getval(CFG_ID("NTP.server.3")));
+  Serial.printf("clk : timezone: %s\n", cfg.getval(CFG_ID("Timezone")) );
   settimeofday_cb( [](){Serial.printf("clk : NTP sync\n");} );  // Pass lambda function to print SET when time is set
 
   if (ota_on)
@@ -146,6 +169,7 @@ void setup() {
               Serial.println("Start updating " + type);
           }
           sync = false;
+          DispAnim::stop();
           disp.show("OtA");
           });
       ArduinoOTA.onEnd([]() {
@@ -154,21 +178,9 @@ void setup() {
           });
       ArduinoOTA.onProgress([](unsigned int progress, unsigned int total) {
           static int prog = 0;
-          static char disp_raw[6] = "    ";
-          static int dots = 0;
-          const int dots_mask = 0b10000;
           int newprog = progress*200 / total ;
-
           int val = (progress << 3) / total;
 
-          if (val)
-          {
-              if (val % 2) //odd
-                  disp_raw[val >> 1] = 'I'; // '`';
-              else
-                  disp_raw[(val >> 1) - 1] = 'X'; // '\"';
-          }
-
           if (newprog < prog) // reset
           {
               prog = 0;
@@ -176,12 +188,9 @@ void setup() {
           else if (newprog - prog > 1)
           {
               prog = newprog;
-              if (!dots)
-                  dots = dots_mask;
-              dots >>= 1;
-              Serial.printf("Progress: %3u%% %d:[%s]\n", newprog/2, val, disp_raw);
+              Serial.printf("Progress: %3u%% %d/8\n", newprog/2, val);
           }
-          disp.show(disp_raw, dots & 0b1101);
+          DispAnim::seek("ota", val);
           });
 
       ArduinoOTA.onError([](ota_error_t error) {
@@ -255,6 +264,8 @@ void loop()
     // Record that seconds changed, for colon
     colon_prev = snow->tm_sec; 
     colon_msecs = millis();
+    // Once a minute, report how many of the display writes actually reached the bus
+    if (snow->tm_sec == 0) Serial.printf("disp: frames %u, refreshes %u, writes %u\n", disp.getStats().frames, disp.getStats().refreshes, disp.getStats().writes);
   }
 
   if (sync)
@@ -262,10 +273,10 @@ void loop()
       char bnow[5];
       int dots = DISP_DOTNO;
 
-      if (animRunning)
+      if (!synced)
       {
-          dispTick.detach();
-          animRunning = false;
+          DispAnim::start("sync"); // replaces the NTP spinner
+          synced = true;
       }
 
       if (show_date)
@@ -296,7 +307,7 @@ void loop()
           }
       }
       //disp_show(bnow, dots);
-      disp.show(bnow, dots);
+      if (!DispAnim::running()) disp.show(bnow, dots);
   }
   
 }
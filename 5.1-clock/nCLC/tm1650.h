@@ -0,0 +1,27 @@
+// tm1650.h - interface for a fast driver for the TM1650 on the 303WIFILC01 board (SDA on GPIO13, SCL on GPIO12)
+#ifndef _TM1650_H_
+#define _TM1650_H_
+
+#include <stdint.h>
+
+// Commands (register addresses as they appear on the bus)
+#define TM1650_CONTROL 0x48 // Control register (brightness, 7/8 segments, power)
+#define TM1650_DIGIT1  0x68 // Data register of the left-most digit; the others follow at 0x6A, 0x6C, 0x6E
+
+// Configures the pins, and sets the bus clock to `hz` (the TM1650 is driven by bit banging, so
+// this is not limited to the 100k/400k of Wire; the actual clock is somewhat lower due to loop overhead).
+void     tm1650_init(uint32_t hz=400000);
+
+// Returns the configured bus clock (Hz)
+uint32_t tm1650_clock();
+
+// Writes `val` to register `cmd` (one START cmd val STOP transaction). Returns 0 for ok, otherwise the number of missing ACKs.
+// The bus routines are in IRAM, so they may be called from a timer callback; they do not disable interrupts
+// (an interrupt only stretches a clock period, which the TM1650 allows).
+int      tm1650_write(uint8_t cmd, uint8_t val);
+
+// Writes the four data registers (`segs[0]` is the left-most digit) and the control register in one burst.
+// Returns 0 for ok, otherwise the number of missing ACKs.
+int      tm1650_frame(const uint8_t * segs, uint8_t control);
+
+#endif
@@ -30,7 +30,7 @@ static void wifi_sethostname(int len=WL_MAC_ADDR_LENGTH) {
 
 // Initializes the WiFi driver.
 // Sets up WiFi for the three SSIDs the user configured.
-void wifi_init(char*s1,char*p1,char*s2,char*p2, char*s3,char*p3) {
+void wifi_init(const char*s1,const char*p1,const char*s2,const char*p2, const char*s3,const char*p3) {
   wifi_sethostname(3);
   WiFi.persistent(false);
   WiFi.mode(WIFI_STA);
@@ -3,7 +3,7 @@
 #define _WIFI_H_
 
 
-void wifi_init(char*s1,char*p1,char*s2,char*p2, char*s3,char*p3); // Initializes the WiFi driver
+void wifi_init(const char*s1,const char*p1,const char*s2,const char*p2, const char*s3,const char*p3); // Initializes the WiFi driver
 bool wifi_isconnected(); // Prints WiFi status to the user (over Serial, only when changed), and returns true iff connected
 
 
@@ -0,0 +1,47 @@
+// fetch.h - interface to a resumable HTTP(S) GET that does a bounded amount of work per call
+#ifndef _FETCH_H_
+#define _FETCH_H_
+
+
+#include <Print.h>
+
+
+// Results of fetch_step(), besides the (negative) HTTPC_ERROR_XXX codes of ESP8266HTTPClient.h
+#define FETCH_DONE            0     // The body is completely written to the sink
+#define FETCH_BUSY            1     // Not yet done, call fetch_step() again (e.g. in the next loop())
+#define FETCH_HEADERS         2     // The response headers are in, see fetch_status(); call fetch_step() for the body, or fetch_end() to skip it
+#define FETCH_ERROR_REDIRECT  (-20) // A redirect without (valid) location, or too many redirects
+
+
+// Starts a GET of `url` (http or https, certificates are not checked); redirects are followed.
+// Resolved addresses (http; for https lwIP's cache is used) and TLS sessions are cached per host, so that a next fetch
+// skips the DNS round trip and does an abbreviated TLS handshake; a redirect to the same server reuses the connection.
+// Timings are logged per request, with whether the address was cached and whether the TLS session was resumed.
+// The TLS client is allocated once. Its buffers are 1k (instead of 16k) for servers that support Maximum Fragment Length
+// Negotiation (probed once per host). Free heap and largest free block are logged before and after each fetch.
+// `extra` are extra request header lines (each terminated with \r\n), e.g. for a conditional GET; it may be 0.
+// The values of the `count` response headers named in `keys` (lower case) are available via fetch_header(); `keys` must stay valid.
+// Returns false if the url is not supported.
+bool   fetch_begin(const char * url, const char * extra, const char * const * keys, int count);
+
+
+// Does the next step of the fetch: resolve, connect (and TLS handshake), send request, or process a bounded
+// number of received bytes (status, headers, body). Body bytes (chunked transfer encoding removed) are written
+// to `sink`; a sink that accepts less than offered aborts the fetch with HTTPC_ERROR_STREAM_WRITE.
+// Returns FETCH_BUSY, FETCH_HEADERS (once), FETCH_DONE, or an error. On done or error, the connection is closed.
+// Note that the connect step blocks (for https, the TLS handshake takes one to two seconds on an 80MHz ESP8266).
+int    fetch_step(Print * sink);
+
+
+// Aborts the fetch (closes the connection); no-op when no fetch is busy.
+void   fetch_end();
+
+
+// Results of the last response (available after fetch_step() returned FETCH_HEADERS).
+int    fetch_status();           // HTTP status code
+int    fetch_size();             // Content-Length of the body, or -1 if unknown
+const char * fetch_header(int i);// Value of response header `keys[i]` (see fetch_begin), or "" if absent
+int    fetch_received();         // Number of body bytes written to the sink so far
+
+
+#endif
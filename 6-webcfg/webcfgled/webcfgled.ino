@@ -1,8 +1,9 @@
 // webcfgled.ino - use a google spreadsheet to configure how often the LED should flash
 #include <Arduino.h>
 #include <ESP8266WiFi.h>
-#include <ESP8266HTTPClient.h>
-#include <WiFiClientSecureBearSSL.h>
+#include <ESP8266HTTPClient.h> // HTTP_CODE_XXX and errorToString()
+#include <StreamString.h>
+#include "fetch.h" // Shared with bCLC: https fetch with TLS buffers allocated once (and shrunk with MFLN)
 
 
 // ===== WebCfg =========================================================================
@@ -28,62 +29,33 @@ String webcfg_getfile(const char * url, String & filecontent) {
   // Function either returns "" (ok case, `filecontent` has content)
   // or returns a non-empty error string (and filecontent is "").
   filecontent = "";
-  
-  // We need to specify which headers we want to look at (only: location for redirect)
-  static const char * headerkeys[] = {"location"} ;
-  static const size_t headercount = sizeof(headerkeys)/sizeof(const char *);
-
-  // We need an SSL client, because google sheets uses https (but we don't care about the server fingerprint)
-  std::unique_ptr<BearSSL::WiFiClientSecure> client(new BearSSL::WiFiClientSecure);
-  client->setInsecure(); // happy to ignore the SSL certificate, else client->setFingerprint(uint8_t[20]);
-  HTTPClient https;
-
-  // Setup the request
-  bool ok = https.begin(*client, url);
-  https.collectHeaders(headerkeys,headercount);
+
+  // Setup the request (fetch follows the redirect that google docs does, and uses https without checking the certificate)
+  bool ok = fetch_begin(url, 0, 0, 0);
   if( !ok ) {
     return "unable to begin";
-  } 
-
-  // Get the response
-  int httpCode = https.GET();
-
-  // GET failed?
-  if( httpCode<0 ) {
-    https.end();
-    return String("code ")+httpCode+" "+https.errorToString(httpCode);
   }
 
-  // GET successful (server with no redirect)
-  if( httpCode == HTTP_CODE_OK ) {
-    filecontent = https.getString();
-    https.end();
-    return "";
-  } 
-
-  // GET with redirect (as google docs does)
-  if( httpCode==HTTP_CODE_TEMPORARY_REDIRECT ) {
-    // Extract the temporary location (url)
-    String location = https.header("location");
-    // New https request
-    https.end();
-    ok = https.begin(*client, location);
-    if( !ok ) {
-      return "unable to begin redirect";
+  // Get the response, the body is collected in `content`
+  StreamString content;
+  int res;
+  do {
+    res = fetch_step(&content);
+    // Response is not the file?
+    if( res==FETCH_HEADERS && fetch_status()!=HTTP_CODE_OK ) {
+      fetch_end();
+      return String("can't handle code ")+fetch_status();
     }
-    httpCode = https.GET();
-    if( httpCode == HTTP_CODE_OK  ) {
-      filecontent = https.getString();
-      https.end();
-      return "";
-    }
-    https.end();
-    return String("redirect code ")+httpCode+" "+https.errorToString(httpCode);
+    yield();
+  } while( res==FETCH_BUSY || res==FETCH_HEADERS );
+
+  // Fetch failed?
+  if( res!=FETCH_DONE ) {
+    return String("code ")+res+" "+HTTPClient::errorToString(res);
   }
 
-  // Still here?
-  https.end();
-  return String("can't handle code ")+httpCode;
+  filecontent = content;
+  return "";
 }
 
 
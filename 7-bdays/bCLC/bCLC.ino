@@ -10,12 +10,16 @@
 #include <coredecls.h> // Only needed for settimeofday_cb()
 #include <core_version.h> // ARDUINO_ESP8266_RELEASE
 #include <time.h>
+#include <sys/time.h> // gettimeofday()
 #include <Cfg.h> // A library that lets a user configure an ESP8266 app (https://github.com/maarten-pennings/Cfg)
 #include "led.h"
 #include "but.h"
 #include "disp.h"
 #include "wifi.h"
 #include "cal.h"
+#include "banner.h"
+#include "marquee.h"
+#include "tasks.h"
 
 
 // A demo spreadsheet
@@ -46,6 +50,12 @@ NvmField cfg_fields[] = {
   {"calurl"          , CALURL                       ,128, "URL to a CSV file with name,YYYY-MM-DD lines (if blank, no calendar)." },
   {"caldays"         , "7"                          ,  3, "Birthdays are listed if they are within 'caldays' days." },
   {"calmin"          , "5"                          ,  3, "Birthdays are displayed if minutes is divisable by 'calmin'. " },
+  // Fields below were added later; they come last so that the stored fields above keep their place in EEPROM
+  {"caltag"          , ""                           ,  4, "Prefix for the names of 'calurl' (optional, may be blank)." },
+  {"calurl.2"        , ""                           ,128, "URL to a second CSV file, merged with the first (optional, may be blank)." },
+  {"caltag.2"        , ""                           ,  4, "Prefix for the names of 'calurl.2', e.g. <b>F</b> for family (optional, may be blank)." },
+  {"calurl.3"        , ""                           ,128, "URL to a third CSV file, merged with the others (optional, may be blank)." },
+  {"caltag.3"        , ""                           ,  4, "Prefix for the names of 'calurl.3' (optional, may be blank)." },
 
   {0                 , 0                            ,  0, 0},  
 };
@@ -69,6 +79,12 @@ const char * render_months=" 1 2 3 4 5 6 7 8 9101112";
 // Do we need to load the calendar; this flag is raised true on start-up, at midnight, and on user request (button press)
 bool cal_tobe_loaded;
 
+// Do we need to show the calendar restored from the cache (at start-up, before the first load completes)
+bool cal_tobe_shown;
+
+// Is a calendar load in progress (see cal_load_step)
+bool cal_loading;
+
 // Margin for birthdays; if they are this close, show them.
 int  caldays;
 
@@ -76,6 +92,14 @@ int  caldays;
 int  calmin;
 
 
+// The tasks (see tasks.h); their ids are assigned in setup(), the tasks are below loop()
+int  tid_btn, tid_clock, tid_scroll, tid_cal, tid_wifi, tid_stats;
+void task_btn(); void task_clock(); void task_scroll(); void task_cal(); void task_wifi(); void task_stats();
+IRAM_ATTR void tid_btn_wake() { tasks_wake(tid_btn); }
+void tid_scroll_wake() { tasks_wake(tid_scroll); }
+void tid_wifi_wake() { tasks_wake(tid_wifi); }
+
+
 void setup() {
   Serial.begin(115200);
   do delay(500); while( !Serial );
@@ -103,7 +127,7 @@ void setup() {
   // LED on
   led_init();
   led_on(); 
-  but_init();
+  but_init(tid_btn_wake);
 
   // Preprocess config for rendering
   disp_show("NtP");
@@ -127,49 +151,89 @@ void setup() {
   
   // Calendar
   cal_init();
-  cal_tobe_loaded = cfg.getval("calurl")[0] != '\0'; // if Cfg has a calender URL, the calendar must be loaded
-  if( cal_tobe_loaded ) Serial.printf("cal : csv at %s\n", cfg.getval("calurl") ); else Serial.printf("cal : no URL\n");
+  cal_source_set(0, cfg.getval("calurl"), cfg.getval("caltag") );
+  cal_source_set(1, cfg.getval("calurl.2"), cfg.getval("caltag.2") );
+  cal_source_set(2, cfg.getval("calurl.3"), cfg.getval("caltag.3") );
+  const char * calurls[] = { cfg.getval("calurl"), cfg.getval("calurl.2"), cfg.getval("calurl.3") };
+  cal_tobe_loaded = false;
+  for( int src=0; src<CAL_SOURCES; src++ ) {
+    if( calurls[src][0]=='\0' ) continue;
+    Serial.printf("cal : csv %d at %s\n", src+1, calurls[src] );
+    cal_tobe_loaded = true; // if Cfg has a calender URL, the calendar must be loaded
+  }
+  if( !cal_tobe_loaded ) Serial.printf("cal : no URL\n");
+  if( cal_tobe_loaded ) cal_tobe_shown = cal_restore()==0; // cached calendar is shown as soon as time is known
   caldays = String(cfg.getval("caldays")).toInt();
   calmin = String(cfg.getval("calmin")).toInt();
   if( calmin<0 ) calmin = 1;
   Serial.printf("cal : every %d minutes, max %d days\n", calmin, caldays);
+
+  // Tasks; instead of running loop() at full speed, the CPU sleeps until the next deadline
+  tid_btn    = tasks_add("btn"   , task_btn   , 0    ); // woken by the button interrupt
+  tid_clock  = tasks_add("clock" , task_clock , 0    ); // re-arms itself at every half second
+  tid_scroll = tasks_add("scroll", task_scroll, 0    ); // woken by the marquee timer
+  tid_cal    = tasks_add("cal"   , task_cal   , 0    ); // armed when the calendar must be shown or loaded
+  tid_wifi   = tasks_add("wifi"  , task_wifi  , 1000 );
+  tid_stats  = tasks_add("stats" , task_stats , 60000);
+  tasks_at(tid_btn, 0);
+  tasks_at(tid_clock, 0);
+  if( cal_tobe_loaded ) tasks_at(tid_cal, 0);
+  marquee_notify(tid_scroll_wake);
+  wifi_notify(tid_wifi_wake);
   
   // App starts running
   Serial.printf("\n");
 }
 
 
-// Record last received seconds, to blink colon
+// Record last received seconds, to do the once-per-second work
 int       colon_prev_sec = -1;
-uint32_t  colon_msecs;
 
 
 // Showing time or date
 #define   MODE_TIME    1
 #define   MODE_DATE    2
 #define   MODE_BDAYS   3
-int       mode_tag = MODE_TIME; // one of MODE_XXX, what to display
-String    mode_bdays;      // The string (with bdays) to show when mode_tag==MODE_BDAYS
-int       mode_step;       // Character index into mode_bdays for scrolling
-uint32_t  mode_stepms;     // time stamp fro scrolling
-#define   MODE_STEP_MS 500 // Scroll time for one step
-bool      flag_bdays_avail = false;
+int       mode_tag = MODE_TIME; // one of MODE_XXX, what to display (MODE_BDAYS scrolls the banner)
+#define   MODE_STEP_MS 500 // Scroll time for one step (a char)
+const marquee_cfg_t mode_marquee = { MODE_STEP_MS, 0, 0, MARQUEE_HALFSTEP }; // banner is padded, so no pauses needed
 
-void loop() {
-  // If in config mode, do config loop (when config completes, it restarts the device)
-  if( cfg.cfgmode() ) { cfg.loop(); return; }
 
-  // In normal application mode
-  led_set( !wifi_isconnected() );     // LED is on when not connected
+// Starts scrolling the banner
+void mode_bdays_start() {
+  Serial.printf("cal : show '%s'\n",banner_text() );
+  marquee_play( banner_strip(), banner_striplen(), &mode_marquee );
+  mode_tag = MODE_BDAYS;
+  tasks_at(tid_scroll, 0);
+}
+
+
+// Makes the banner (from the calendar and the `error` of cal_load_step()), then starts scrolling it.
+void mode_bdays_make(const struct tm * snow, int error) {
+  banner_make(snow, caldays, error);
+  mode_bdays_start();
+}
+
+
+// Task: handles the button events (woken by the button interrupt, and again when a long press or repeat is due)
+void task_btn() {
+  but_event_t ev;
+  while( but_event(&ev) ) {
+    if( ev.but==BUT3 && (ev.kind==BUT_PRESS || ev.kind==BUT_REPEAT) ) disp_brightness_set( disp_brightness_get()%8 + 1 ); // Hold to keep stepping
+    if( ev.but==BUT2 && ev.kind==BUT_PRESS ) { if( mode_tag==MODE_BDAYS ) marquee_stop(); mode_tag = mode_tag==MODE_DATE ? MODE_TIME : MODE_DATE; tasks_at(tid_clock, 0); }
+    if( ev.but==BUT1 && ev.kind==BUT_SHORT ) { cal_tobe_loaded = true; tasks_at(tid_cal, 0); } // Explicit request by user to load the calendar (not on a long press)
+    if( ev.but==BUT1 && ev.kind==BUT_LONG && banner_striplen()>0 ) mode_bdays_start(); // Replay the banner
+  }
+  int wait = but_wait();
+  if( wait>=0 ) tasks_at(tid_btn, wait);
+}
 
-  // Check buttons
-  but_scan();
-  if( but_wentdown(BUT3) ) disp_brightness_set( disp_brightness_get()%8 + 1 );
-  if( but_wentdown(BUT2) ) mode_tag = mode_tag==MODE_DATE ? MODE_TIME : MODE_DATE; 
-  if( but_wentdown(BUT1) ) cal_tobe_loaded = true; // Explicit request by user to load the calendar
 
-  // Get time in parts
-  time_t      tnow= time(NULL);       // Returns seconds (and writes to the passed pointer, when not NULL) - note `time_t` is just a `long`.
+// Task: the once-per-second work, and rendering time or date; runs at every half second (the colon blinks)
+void task_clock() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  time_t      tnow= tv.tv_sec;
   struct tm * snow= localtime(&tnow); // Returns a struct with time fields (https://www.tutorialspoint.com/c_standard_library/c_function_localtime.htm)
   bool        sync= snow->tm_year>120;// We miss-use "old" time as indication of "time not yet set" (year is 1900 based)
 
@@ -177,106 +241,96 @@ void loop() {
   if( snow->tm_sec != colon_prev_sec ) {
     // In `snow` the `tm_year` field is 1900 based, `tm_mon` is 0 based, rest is as expected
     Serial.printf("main: %d-%02d-%02d %02d:%02d:%02d (dst=%d) %s\n", snow->tm_year + 1900, snow->tm_mon + 1, snow->tm_mday, snow->tm_hour, snow->tm_min, snow->tm_sec, snow->tm_isdst, sync?"":"NO NTP" );
-    // Record that seconds changed, for colon
     colon_prev_sec = snow->tm_sec; 
-    colon_msecs = millis();
     // Reload cal every midnight
-    if( (snow->tm_hour==0) && (snow->tm_min==0) && (snow->tm_sec==0) ) cal_tobe_loaded = true;
+    if( (snow->tm_hour==0) && (snow->tm_min==0) && (snow->tm_sec==0) ) { cal_tobe_loaded = true; tasks_at(tid_cal, 0); }
+    // Banner lists the days till the birthdays, so it is remade every day (e.g. when the midnight reload fails)
+    if( sync && !cal_tobe_shown && !cal_loading && !cal_tobe_loaded && banner_isstale(snow) && banner_striplen()>0 ) banner_make(snow, caldays, 0);
     // Show cal every calmin minutes
-    if( flag_bdays_avail && (mode_tag!=MODE_BDAYS ) && (snow->tm_sec==0) && (snow->tm_min % calmin == 0) ) {
-      mode_tag = MODE_BDAYS;
-      mode_step = 0;
-      mode_stepms = millis()-MODE_STEP_MS;
-    }
+    if( banner_hasbdays() && (mode_tag!=MODE_BDAYS ) && (snow->tm_sec==0) && (snow->tm_min % calmin == 0) ) mode_bdays_start();
   }
 
-  if( sync ) {
-    // Update the display
-    switch( mode_tag ) {
-      case MODE_TIME: {
-        bool pm = snow->tm_hour >= 12;
-        int  hr = snow->tm_hour % render_hours_len;
-        char buf[5];
-        sprintf(buf,"%2d%02d", hr, snow->tm_min );
-        int dots = millis()-colon_msecs<500 ? DISP_DOTNO : DISP_DOTCOLON;
-        if( render_hours_flag==RENDER_HOURS_FLAG_AM && !pm ) dots |= DISP_DOT1;
-        if( render_hours_flag==RENDER_HOURS_FLAG_PM &&  pm ) dots |= DISP_DOT1;
-        if( flag_bdays_avail ) dots |= DISP_DOT4;
-        disp_show(buf,dots);
-        break; 
-      }
-      case MODE_DATE: {
-        char buf[5];
-        if( render_dayfirst ) 
-          sprintf(buf,"%2d%c%c", snow->tm_mday, render_months[snow->tm_mon*2], render_months[snow->tm_mon*2+1] );
-        else
-          sprintf(buf,"%c%c%2d", render_months[snow->tm_mon*2], render_months[snow->tm_mon*2+1], snow->tm_mday );
-        int dots = flag_bdays_avail ? DISP_DOT4 : DISP_DOTNO;
-        disp_show(buf,dots);
-        break; 
-      }
-      case MODE_BDAYS: {
-        if( millis()-mode_stepms > MODE_STEP_MS ) {
-          if( mode_step==0 ) Serial.printf("cal : show '%s'\n",mode_bdays.c_str() );
-          char buf[5];
-          buf[0]= mode_bdays[mode_step];        
-          buf[1]= mode_bdays[mode_step+1];
-          buf[2]= mode_bdays[mode_step+2];
-          buf[3]= mode_bdays[mode_step+3];
-          buf[4]='\0';
-          disp_show(buf);
-          // Serial.printf("cal : %s\n",buf);
-          mode_step++;
-          mode_stepms = millis();
-          if( mode_step+5 > mode_bdays.length() ) mode_tag = MODE_TIME;
-        }
-        break;
-      }
-    }
+  if( sync && mode_tag==MODE_TIME ) {
+    bool pm = snow->tm_hour >= 12;
+    int  hr = snow->tm_hour % render_hours_len;
+    char buf[5];
+    sprintf(buf,"%2d%02d", hr, snow->tm_min );
+    int dots = tv.tv_usec<500000 ? DISP_DOTNO : DISP_DOTCOLON;
+    if( render_hours_flag==RENDER_HOURS_FLAG_AM && !pm ) dots |= DISP_DOT1;
+    if( render_hours_flag==RENDER_HOURS_FLAG_PM &&  pm ) dots |= DISP_DOT1;
+    if( banner_hasbdays() ) dots |= DISP_DOT4;
+    disp_show(buf,dots);
+  } else if( sync && mode_tag==MODE_DATE ) {
+    char buf[5];
+    if( render_dayfirst ) 
+      sprintf(buf,"%2d%c%c", snow->tm_mday, render_months[snow->tm_mon*2], render_months[snow->tm_mon*2+1] );
+    else
+      sprintf(buf,"%c%c%2d", render_months[snow->tm_mon*2], render_months[snow->tm_mon*2+1], snow->tm_mday );
+    int dots = banner_hasbdays() ? DISP_DOT4 : DISP_DOTNO;
+    disp_show(buf,dots);
+  }
+
+  // Next run just after the next half second
+  tasks_at(tid_clock, (tv.tv_usec<500000 ? 500000-tv.tv_usec : 1000000-tv.tv_usec)/1000 + 1);
+}
+
+
+// Task: puts the marquee frame on the display (woken by the marquee timer at every frame)
+void task_scroll() {
+  if( mode_tag!=MODE_BDAYS ) return;
+  // The marquee's timer advances the frames; only changed digits reach the bus
+  disp_show_raw( marquee_frame() );
+  if( !marquee_busy() ) { mode_tag = MODE_TIME; tasks_at(tid_clock, 0); }
+}
+
 
-    // Get calendar
-    if( cal_tobe_loaded ) {
-      int error = cal_load( cfg.getval("calurl") );
-      if( error<0 ) {
-        Serial.printf("cal : load error %d\n",error);
-        mode_bdays = String("Error ") + error + " lOAd";
-      } else if( error>0 ){
-        Serial.printf("cal : file error %d\n",error);
-        mode_bdays = String("Error ") + (error%10) + " lINE " + (error/10);
-      } else if( cal_size==0 ) {
-        Serial.printf("cal : empty\n");
-        mode_bdays = "Error no RECS";
-      } else {
-        int today = cal_daynum( snow->tm_mon+1,snow->tm_mday);
-        int ix1 = cal_findfirst(snow->tm_mon+1,snow->tm_mday);
-        // Serial.printf("cal : first bday %d/%s %04d-%02d-%02d\n",ix1,cal_label(ix1),cal_year(ix1),cal_month(ix1),cal_day(ix1));
-        int ix=ix1;
-        mode_bdays = "";
-        while( 1 ) {
-          int daynum = cal_daynum( cal_month(ix), cal_day(ix) );
-          Serial.printf("cal : bday in %d days %s %04d-%02d-%02d\n",daynum-today,cal_label(ix).c_str(),cal_year(ix),cal_month(ix),cal_day(ix));
-          if( daynum < today+caldays ) {
-            int age = snow->tm_year + 1900 - cal_year(ix);
-            if( ix<ix1 ) age++;
-            if( mode_bdays!="" ) mode_bdays += "  -  ";
-            mode_bdays = mode_bdays+(daynum-today)+" "+cal_label(ix)+" "+age;
-            flag_bdays_avail = true;
-          }
-          ix = (ix+1)%cal_size(); // with wrap around
-          if( ix==0 ) today -=365; // add one year (by antidating today)
-          if( ix==ix1 ) break; // stop if we are at begin
-        }
-        if( mode_bdays=="" ) mode_bdays = "no-bdays"; 
-        Serial.printf("cal : bdays %s\n",mode_bdays.c_str());
-      }
-      // Prepare for scroll  
-      mode_tag = MODE_BDAYS;
-      mode_bdays = "    " + mode_bdays+"     "; // to start and end the display clean (one extra at end)
-      mode_step = 0;
-      mode_stepms = millis()-MODE_STEP_MS;
-      cal_tobe_loaded = false;
+// Task: shows the calendar from cache, and loads it (one step per run, so that the display keeps running)
+void task_cal() {
+  time_t      tnow= time(NULL);
+  struct tm * snow= localtime(&tnow);
+  if( snow->tm_year<=120 ) { tasks_at(tid_cal, 1000); return; } // Wait for NTP
+  // Show calendar from cache, its reload follows in the next run
+  if( cal_tobe_shown ) {
+    mode_bdays_make(snow,0);
+    cal_tobe_shown = false;
+    tasks_at(tid_cal, 0);
+  } else if( cal_tobe_loaded ) {
+    cal_load_begin();
+    cal_tobe_loaded = false;
+    cal_loading = true;
+    tasks_at(tid_cal, 0);
+  } else if( cal_loading ) {
+    int error = cal_load_step();
+    if( error!=CAL_BUSY ) {
+      mode_bdays_make(snow,error);
+      cal_loading = false;
+    } else {
+      tasks_at(tid_cal, 0);
     }
   }
+}
+
+
+// Task: WiFi supervision (timeouts and retries; woken when the WiFi state changes)
+void task_wifi() {
+  wifi_step();
+  led_set( !wifi_isconnected() );     // LED is on when not connected
+}
+
+
+// Task: once a minute, report how many of the display writes actually reached the bus, and the scheduler statistics
+void task_stats() {
+  uint32_t frames, writes; 
+  disp_stats(&frames,&writes); 
+  Serial.printf("disp: frames %u, writes %u\n", frames, writes);
+  tasks_report();
+}
+
+
+void loop() {
+  // If in config mode, do config loop (when config completes, it restarts the device)
+  if( cfg.cfgmode() ) { cfg.loop(); return; }
 
-  // No delay - run at full speed
+  // In normal application mode: run the tasks that are due, sleep till the next deadline
+  tasks_run();
 }
@@ -0,0 +1,128 @@
+// banner.cpp - the (scrolling) banner with the upcoming birthdays
+
+#include <Arduino.h>
+#include "disp.h"
+#include "cal.h"
+#include "banner.h"
+
+
+#ifndef BANNER_INCLUDE_BENCH
+#define BANNER_INCLUDE_BENCH 0 // host/bench.cpp builds it with 1 on a PC
+#endif
+
+
+// The banner text and its rendering have a fixed capacity, so making it does not allocate.
+#define BANNER_PAD 4 // Spaces before and after the text, so that it scrolls in and out of the 4 digit display
+static char    banner_chars[BANNER_SIZE];
+static uint8_t banner_segments[BANNER_SIZE];
+static int     banner_len;      // Number of chars in banner_chars (including padding)
+static int     banner_seglen;   // Number of digits in banner_segments (dots are folded, so at most banner_len)
+static bool    banner_verbose = true; // Log the birthdays (off while benchmarking)
+static int     banner_day = -1; // Day the banner was made (year*1000+yday), -1 if not made
+static bool    banner_bdays;    // The banner lists at least one birthday
+
+
+// Appends `s` to the banner, if it fits (keeping room for "..." and the trailing padding). Returns false if not.
+static bool banner_append(const char * s) {
+  int len = strlen(s);
+  if( banner_len+len > BANNER_SIZE-1-3-BANNER_PAD ) return false;
+  memcpy(&banner_chars[banner_len], s, len);
+  banner_len += len;
+  return true;
+}
+
+
+#if BANNER_INCLUDE_BENCH
+  // Makes the banner for every day of a (leap) year on the loaded calendar, and reports how much
+  // shorter (in digits, so also in scroll time) folding the dots makes it.
+  static void banner_bench(int days) {
+    static const int dim[] = {31,29,31,30,31,30,31,31,30,31,30,31};
+    banner_verbose = false;
+    long chars=0, digits=0;
+    int count=0, maxpct=0;
+    uint32_t t0 = micros();
+    for( int month=1; month<=12; month++ ) for( int day=1; day<=dim[month-1]; day++ ) {
+      struct tm t = {};
+      t.tm_year = 2024-1900; t.tm_mon = month-1; t.tm_mday = day; t.tm_yday = cal_daynum(month,day);
+      banner_make(&t, days, 0);
+      chars += banner_len; digits += banner_seglen; count++;
+      if( banner_len>0 ) maxpct = max(maxpct, 100*(banner_len-banner_seglen)/banner_len);
+    }
+    uint32_t t1 = micros();
+    banner_verbose = true;
+    Serial.printf("cal : bench %d banners (%d days, %d entries): %ld chars, %ld digits, %ld%% shorter (max %d%%), %u us/banner\n",
+      count, days, cal_size(), chars, digits, chars ? 100*(chars-digits)/chars : 0, maxpct, (unsigned)((t1-t0)/count) );
+  }
+#endif
+
+
+void banner_make(const struct tm * snow, int days, int error) {
+  char part[64];
+  banner_len = 0;
+  banner_bdays = false;
+  banner_append("    "); // BANNER_PAD
+  if( error<0 ) {
+    if( banner_verbose ) Serial.printf("cal : load error %d\n",error);
+    snprintf(part, sizeof(part), "Error %d lOAd", error);
+    banner_append(part);
+  } else if( error>0 ){
+    if( banner_verbose ) Serial.printf("cal : file error %d\n",error);
+    snprintf(part, sizeof(part), "Error %d lINE %d", error%10, error/10);
+    banner_append(part);
+  }
+  if( cal_size()==0 ) {
+    if( banner_verbose ) Serial.printf("cal : empty\n");
+    if( error==0 ) banner_append("Error no RECS");
+  } else {
+    // When one source failed, the error is followed by the birthdays of the others
+    if( error!=0 ) banner_append("  -  ");
+    int len0 = banner_len;
+    bool truncated = false;
+    cal_window_begin( snow->tm_year+1900, snow->tm_mon+1, snow->tm_mday, days );
+    int ix, daysuntil, age;
+    while( (ix=cal_window_next(&daysuntil,&age)) >= 0 ) {
+      if( banner_verbose ) Serial.printf("cal : bday in %d days %s%s %04d-%02d-%02d\n",daysuntil,cal_tag(ix),cal_label(ix),cal_year(ix),cal_month(ix),cal_day(ix));
+      snprintf(part, sizeof(part), "%s%d %s%s %d", banner_len>len0?"  -  ":"", daysuntil, cal_tag(ix), cal_label(ix), age);
+      if( !truncated && !banner_append(part) ) truncated = true;
+      banner_bdays = true;
+    }
+    if( truncated ) { memcpy(&banner_chars[banner_len], "...", 3); banner_len += 3; if( banner_verbose ) Serial.printf("cal : banner full\n"); }
+    if( !banner_bdays ) banner_append("no-bdays");
+  }
+  memset(&banner_chars[banner_len], ' ', BANNER_PAD);
+  banner_len += BANNER_PAD;
+  banner_chars[banner_len] = '\0';
+  // Lay out once (dots folded into the preceding digit), so that scrolling only copies segment bytes
+  banner_seglen = disp_layout(banner_chars, banner_segments, BANNER_SIZE);
+  banner_day = (snow->tm_year)*1000 + snow->tm_yday;
+  if( banner_verbose ) Serial.printf("cal : bdays '%s' (%d chars, %d digits)\n", banner_chars, banner_len, banner_seglen);
+#if BANNER_INCLUDE_BENCH
+  static bool benched;
+  if( !benched && cal_size()>0 ) { benched = true; banner_bench(days); banner_make(snow, days, error); }
+#endif
+}
+
+
+bool banner_isstale(const struct tm * snow) {
+  return banner_day != (snow->tm_year)*1000 + snow->tm_yday;
+}
+
+
+bool banner_hasbdays() {
+  return banner_bdays;
+}
+
+
+const char * banner_text() {
+  return banner_chars;
+}
+
+
+const uint8_t * banner_strip() {
+  return banner_segments;
+}
+
+
+int banner_striplen() {
+  return banner_seglen;
+}
@@ -0,0 +1,28 @@
+// banner.h - interface to the (scrolling) banner with the upcoming birthdays
+#ifndef _BANNER_H_
+#define _BANNER_H_
+
+#include <time.h>
+
+// Capacity of the banner (text plus padding); birthdays that do not fit are replaced by "..."
+#define BANNER_SIZE 256
+
+// Composes the banner from the calendar: the birthdays in the `days` days starting at `snow`, preceded by the
+// message for `error` (the result of cal_load_step(), 0 for none). The text is rendered to segments right away,
+// so scrolling does no font lookups. Call once per day (see banner_isstale) and after each (re)load.
+void banner_make(const struct tm * snow, int days, int error);
+
+// Returns true when the banner was made on another day than `snow` (or not made at all)
+bool banner_isstale(const struct tm * snow);
+
+// Returns true when the banner lists at least one birthday
+bool banner_hasbdays();
+
+// Returns the banner text (padded with 4 spaces at both ends, so that it scrolls in and out)
+const char * banner_text();
+
+// Returns the banner rendered to (TM1650) segment bytes, for marquee_play(); it has banner_striplen() bytes
+const uint8_t * banner_strip();
+int  banner_striplen();
+
+#endif
@@ -9,34 +9,167 @@
 #define BUT3_PIN 15
 
 
-// The button state of the last two `but_scan` calls.
-static int but_state_prev;
-static int but_state_cur;
-
-
-// Scans the button state and records that; check with but_wentdown().
-void but_scan() {
-  but_state_prev = but_state_cur;
-  but_state_cur = 0;
-  if( digitalRead(BUT1_PIN)==LOW  ) but_state_cur |= BUT1; // Low active
-  if( digitalRead(BUT2_PIN)==LOW  ) but_state_cur |= BUT2; // Low active
-  if( digitalRead(BUT3_PIN)==HIGH ) but_state_cur |= BUT3; // High active
+// Edges are captured by the GPIO interrupt handlers, with a time stamp, in a ring buffer. The handlers are the only
+// producer (GPIO interrupts do not nest), but_event() is the only consumer; each side only writes its own index,
+// so the ring needs no lock. The edges are classified later (in loop), so presses during a blocking call are not lost.
+#define BUT_RING 16 // Power of 2
+typedef struct but_edge_s {
+  uint32_t ms;
+  uint8_t  but;
+  uint8_t  down;
+} but_edge_t;
+static but_edge_t       but_ring[BUT_RING];
+static volatile uint8_t but_head; // Written by the handlers
+static volatile uint8_t but_tail; // Written by but_event()
+static volatile uint16_t but_lost;// Edges dropped because the ring was full (written by the handlers only)
+static void (*but_onedge)();      // Called by the handlers after an edge is pushed
+
+
+static IRAM_ATTR void but_push(uint8_t but, uint8_t down) {
+  uint8_t head = but_head;
+  if( (uint8_t)(head-but_tail) >= BUT_RING ) { but_lost++; return; }
+  but_ring[head%BUT_RING].ms = millis();
+  but_ring[head%BUT_RING].but = but;
+  but_ring[head%BUT_RING].down = down;
+  __asm__ __volatile__("" ::: "memory"); // The entry is complete before it is published
+  but_head = head+1;
+  if( but_onedge ) but_onedge();
+}
+
+
+static IRAM_ATTR void but1_isr() { but_push(BUT1, digitalRead(BUT1_PIN)==LOW ); } // Low active
+static IRAM_ATTR void but2_isr() { but_push(BUT2, digitalRead(BUT2_PIN)==LOW ); } // Low active
+static IRAM_ATTR void but3_isr() { but_push(BUT3, digitalRead(BUT3_PIN)==HIGH); } // High active
+
+
+// The classifier state per button.
+typedef struct but_state_s {
+  uint8_t  raw;      // Level of the last edge (1 for down)
+  uint32_t raw_ms;   // Time of the last edge
+  uint8_t  down;     // Debounced level
+  uint8_t  held;     // The current press got its BUT_LONG
+  uint8_t  shortup;  // The last press was short (so a next one may be a double)
+  uint8_t  dbl;      // The current press is a double (so the next one is not)
+  uint32_t up_ms;    // Time of the last (debounced) release
+  uint32_t next_ms;  // Time of the next BUT_LONG or BUT_REPEAT, while down
+} but_state_t;
+static but_state_t but_states[3];
+
+
+// The classified events, waiting to be read by but_event().
+#define BUT_EVENTS 16
+static but_event_t but_events[BUT_EVENTS];
+static uint8_t     but_events_head;
+static uint8_t     but_events_tail;
+static uint16_t    but_events_lost; // Events dropped because the queue was full (not shared with the handlers)
+
+
+static void but_emit(int b, uint8_t kind, uint32_t ms) {
+  if( (uint8_t)(but_events_head-but_events_tail) >= BUT_EVENTS ) { but_events_lost++; return; }
+  but_event_t * ev = &but_events[but_events_head%BUT_EVENTS];
+  ev->but = 1<<b;
+  ev->kind = kind;
+  ev->ms = ms;
+  but_events_head++;
+}
+
+
+// Emits the BUT_LONG and BUT_REPEATs of button `b` that are due at time `ms`.
+static void but_timed(int b, uint32_t ms) {
+  but_state_t * s = &but_states[b];
+  while( s->down && (int32_t)(ms-s->next_ms)>=0 ) {
+    but_emit(b, s->held ? BUT_REPEAT : BUT_LONG, s->next_ms);
+    s->held = 1;
+    s->next_ms += BUT_REPEAT_MS;
+  }
+}
+
+
+// Brings button `b` up to time `ms`: when its last edge is stable for BUT_DEBOUNCE_MS, that edge is a press or release.
+static void but_settle(int b, uint32_t ms) {
+  but_state_t * s = &but_states[b];
+  if( s->raw!=s->down && ms-s->raw_ms>=BUT_DEBOUNCE_MS ) {
+    but_timed(b, s->raw_ms);
+    s->down = s->raw;
+    if( s->down ) {
+      but_emit(b, BUT_PRESS, s->raw_ms);
+      s->dbl = s->shortup && s->raw_ms-s->up_ms<BUT_DOUBLE_MS;
+      if( s->dbl ) but_emit(b, BUT_DOUBLE, s->raw_ms);
+      s->held = 0;
+      s->next_ms = s->raw_ms + BUT_LONG_MS;
+    } else {
+      but_emit(b, BUT_RELEASE, s->raw_ms);
+      if( !s->held ) but_emit(b, BUT_SHORT, s->raw_ms);
+      s->shortup = !s->held && !s->dbl;
+      s->up_ms = s->raw_ms;
+    }
+  }
+  but_timed(b, s->raw!=s->down ? s->raw_ms : ms); // While a release is pending (bouncing), repeats stop at its first edge
+}
+
+
+// Classifies the edges captured since the previous call, and returns the oldest event (if any).
+bool but_event(but_event_t*ev) {
+  static uint16_t lost, events_lost;
+  if( but_events_head==but_events_tail ) {
+    uint8_t head = but_head;
+    __asm__ __volatile__("" ::: "memory"); // Read the entries after their publication
+    while( but_tail!=head ) {
+      but_edge_t * e = &but_ring[but_tail%BUT_RING];
+      int b = e->but==BUT1 ? 0 : e->but==BUT2 ? 1 : 2;
+      but_settle(b, e->ms);
+      // Two edges with the same level means one was missed in a bounce; the level is what counts
+      if( e->down!=but_states[b].raw ) { but_states[b].raw = e->down; but_states[b].raw_ms = e->ms; }
+      but_tail = but_tail+1;
+    }
+    uint32_t now = millis();
+    for( int b=0; b<3; b++ ) but_settle(b, now);
+    if( lost!=but_lost || events_lost!=but_events_lost ) {
+      lost = but_lost;
+      events_lost = but_events_lost;
+      Serial.printf("but : %u edges, %u events lost\n", lost, events_lost);
+    }
+  }
+  if( but_events_head==but_events_tail ) return false;
+  *ev = but_events[but_events_tail%BUT_EVENTS];
+  but_events_tail++;
+  return true;
 }
 
 
-// Returns a mask of buttons pressed during the last `but_scan` and not pressed during the `but_scan` before that.
-int but_wentdown(int buttons) {
-  return (but_state_prev ^ but_state_cur) & but_state_cur & buttons;
+// Returns the time (ms) until but_event() has a pending edge or a long/repeat to classify, or -1 when that needs a new edge.
+int but_wait() {
+  if( but_head!=but_tail ) return 0;
+  uint32_t now = millis();
+  int wait = -1;
+  for( int b=0; b<3; b++ ) {
+    but_state_t * s = &but_states[b];
+    int32_t left;
+    if( s->raw!=s->down ) left = s->raw_ms+BUT_DEBOUNCE_MS-now;
+    else if( s->down ) left = s->next_ms-now;
+    else continue;
+    if( left<0 ) left = 0;
+    if( wait<0 || left<wait ) wait = left;
+  }
+  return wait;
 }
 
 
 // Initializes the button driver.
-// Configures the GPIO block for the button pin.
-void but_init() {
+// Configures the GPIO block for the button pins and attaches the interrupts; they also call `onedge`.
+void but_init(void (*onedge)()) {
+  but_onedge = onedge;
   pinMode(BUT1_PIN, INPUT_PULLUP); // Low active
   pinMode(BUT2_PIN, INPUT_PULLUP); // Low active
   pinMode(BUT3_PIN, INPUT);        // High active
-  but_scan();
-  but_scan();
+  uint32_t now = millis();
+  // A button that is down at boot counts as pressed at boot
+  but_states[0].raw = digitalRead(BUT1_PIN)==LOW;
+  but_states[1].raw = digitalRead(BUT2_PIN)==LOW;
+  but_states[2].raw = digitalRead(BUT3_PIN)==HIGH;
+  for( int b=0; b<3; b++ ) but_states[b].raw_ms = now;
+  attachInterrupt(digitalPinToInterrupt(BUT1_PIN), but1_isr, CHANGE);
+  attachInterrupt(digitalPinToInterrupt(BUT2_PIN), but2_isr, CHANGE);
+  attachInterrupt(digitalPinToInterrupt(BUT3_PIN), but3_isr, CHANGE);
   Serial.printf("but : init\n");
 }
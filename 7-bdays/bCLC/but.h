@@ -3,14 +3,40 @@
 #define _BUT_H_
 
 
+#include <stdint.h>
+
+
 #define BUT1 1
 #define BUT2 2
 #define BUT3 4
 
 
-void but_scan();                // Scans the button state and records that; check with but_wentdown().
-int  but_wentdown(int buttons); // Returns a mask of buttons pressed during the last `but_scan` and not pressed during the `but_scan` before that.
-void but_init();                // Initializes the button driver. Configures the GPIO block for the button pin.
+// Kinds of button events
+#define BUT_PRESS   1 // Button went down (debounced)
+#define BUT_RELEASE 2 // Button went up (debounced)
+#define BUT_LONG    3 // Button is down for BUT_LONG_MS
+#define BUT_REPEAT  4 // Button is still down, every BUT_REPEAT_MS after BUT_LONG
+#define BUT_DOUBLE  5 // Button went down within BUT_DOUBLE_MS after a short press (follows the BUT_PRESS)
+#define BUT_SHORT   6 // Button went up before it got a BUT_LONG (follows the BUT_RELEASE)
+
+
+// Timing of the classification (ms)
+#define BUT_DEBOUNCE_MS 30  // A level must be stable this long to count
+#define BUT_LONG_MS     800
+#define BUT_REPEAT_MS   150
+#define BUT_DOUBLE_MS   300
+
+
+typedef struct but_event_s {
+  uint8_t  but;  // BUT1, BUT2 or BUT3
+  uint8_t  kind; // BUT_PRESS, ..., BUT_SHORT
+  uint32_t ms;   // Time (millis) the event happened, which may be earlier than when it is read
+} but_event_t;
+
+
+void but_init(void (*onedge)()=0); // Initializes the button driver. Configures the GPIO block for the button pins and attaches the interrupts; they also call `onedge` (IRAM), e.g. to wake the loop.
+bool but_event(but_event_t*ev); // Classifies the edges captured since the previous call; returns false if there is no event, otherwise stores the oldest in `ev`.
+int  but_wait();                // Returns the time (ms) until but_event() has a pending edge or a long/repeat to classify, or -1 when that needs a new edge.
 
 
 #endif
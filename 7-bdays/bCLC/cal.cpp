@@ -1,51 +1,153 @@
 // cal.cpp - get calendar information from a google spreadsheet
 #include <Arduino.h>
 #include <ESP8266HTTPClient.h>
-#include <WiFiClientSecureBearSSL.h>
+#include <LittleFS.h>
+#include <coredecls.h> // crc32()
+#include "fetch.h"
 #include "cal.h"
 
 
 #define CAL_INCLUDE_TEST  0
+#ifndef CAL_INCLUDE_BENCH
+#define CAL_INCLUDE_BENCH 0 // host/bench.cpp builds it with 1 on a PC
+#endif
 
 
-typedef struct cal_s {
-  String label;
-  int    year;
-  int    month;
-  int    day;
+// A calendar entry is packed in 5 bytes; its label is stored in the arena of its source.
+typedef struct __attribute__((packed)) cal_s {
+  uint16_t monthday; // Month in bits 8..5, day in bits 4..0 (so that it sorts on month first, then day)
+  uint8_t  year;     // Year minus 1900 (year range is 1900..2100)
+  uint16_t label;    // Offset in the `arena` of its source of the (zero terminated) label
 } cal_t;
-#define       CAL_SIZE 100
-static cal_t  cal_list[CAL_SIZE];
-static int    cal_size_act;
+#define       CAL_MONTHDAY(month,day) ( ((month)<<5) | (day) )
+
+
+// Each source (calendar url) has its own store: a run of entries, sorted after loading.
+// The store is allocated on the heap and sized at load time: from the file size when
+// the server reports it, otherwise it doubles when full. A reload reuses the allocated space.
+// All labels, zero terminated, are stored one after the other in `arena`.
+#define       CAL_SIZE_MIN   64    // Initial number of entries, when the file size is not known
+#define       CAL_ARENA_MIN  1024  // Initial size of the label arena, when the file size is not known
+#define       CAL_ARENA_MAX  65535 // Labels are addressed with a 16 bit offset
+#define       CAL_VALIDATOR_SIZE 64
+typedef struct cal_src_s {
+  const char * url;                     // Configured url (0 or "" if the source is not used)
+  const char * tag;                     // Prefix for the labels of this source
+  cal_t *  list;
+  int      size_act;                    // Number of entries in `list`
+  int      size_cap;                    // Number of entries allocated for `list`
+  char *   arena;
+  int      arena_used;                  // Number of bytes used in `arena`
+  int      arena_cap;                   // Number of bytes allocated for `arena`
+  char     etag[CAL_VALIDATOR_SIZE];    // Validators (ETag and Last-Modified response headers) of the run; empty when not known
+  char     lastmod[CAL_VALIDATOR_SIZE];
+  uint32_t urlhash;                     // Hash of the url the run was loaded from (the validators belong to that url)
+} cal_src_t;
+static cal_src_t   cal_srcs[CAL_SOURCES];
+static cal_src_t * cal_src = &cal_srcs[0]; // The source being loaded; the cal_store_xxx() functions work on its run
+
+
+// Ensures the store has room for (at least) `size` entries and `arena` label bytes.
+// Returns false if that is too much or if there is no heap for it (existing content is kept).
+static bool cal_store_reserve(int size, int arena) {
+  if( size>CAL_SIZE_MAX || arena>CAL_ARENA_MAX ) return false;
+  if( size>cal_src->size_cap ) {
+    cal_t * list = (cal_t *)realloc(cal_src->list, size*sizeof(cal_t));
+    if( list==0 ) return false;
+    cal_src->list = list;
+    cal_src->size_cap = size;
+  }
+  if( arena>cal_src->arena_cap ) {
+    char * chars = (char *)realloc(cal_src->arena, arena);
+    if( chars==0 ) return false;
+    cal_src->arena = chars;
+    cal_src->arena_cap = arena;
+  }
+  return true;
+}
+
+
+// Empties the store; `filesize` is the size of the file that will be loaded (<0 when unknown).
+static void cal_store_clear(int filesize) {
+  cal_src->size_act = 0;
+  cal_src->arena_used = 0;
+  if( filesize<0 ) return;
+  // A typical record "name,YYYY-MM-DD\r\n" is some 16 bytes, about half of it label (with terminating zero)
+  cal_store_reserve( min(filesize/16+1,CAL_SIZE_MAX), min(filesize/2+1,CAL_ARENA_MAX) ); // if it fails, cal_store_add() grows on demand
+}
+
 
+// Appends an entry to the store, growing it when needed.
+// Returns 0 for ok, or 9 when out of space (CAL_SIZE_MAX, CAL_ARENA_MAX or heap).
+static int cal_store_add(const char * label, int labellen, int year, int month, int day) {
+  int size = cal_src->size_act+1;
+  int arena = cal_src->arena_used+labellen+1;
+  if( size>cal_src->size_cap ) size = max( min(2*cal_src->size_cap,CAL_SIZE_MAX), max(size,CAL_SIZE_MIN) );
+  if( arena>cal_src->arena_cap ) arena = max( min(2*cal_src->arena_cap,CAL_ARENA_MAX), max(arena,CAL_ARENA_MIN) );
+  if( !cal_store_reserve(size,arena) ) return 9; // out of space
+  memcpy(&cal_src->arena[cal_src->arena_used], label, labellen);
+  cal_src->arena[cal_src->arena_used+labellen] = '\0';
+  cal_t * entry = &cal_src->list[cal_src->size_act];
+  entry->monthday= CAL_MONTHDAY(month,day);
+  entry->year= year-1900;
+  entry->label= cal_src->arena_used;
+  cal_src->arena_used += labellen+1;
+  cal_src->size_act = cal_src->size_act+1;
+  return 0;
+}
+
+
+// The sorted runs of all sources are merged into `cal_order`: calendar entry `ix` is entry
+// cal_order[ix] & CAL_REF_IX of the run of source cal_order[ix] >> CAL_REF_SRC.
+#define CAL_REF_SRC 13
+#define CAL_REF_IX  ((1<<CAL_REF_SRC)-1)
+#if CAL_SIZE_MAX>CAL_REF_IX+1 || CAL_SOURCES>(1<<(16-CAL_REF_SRC))
+  #error CAL_SIZE_MAX or CAL_SOURCES too big for a 16 bit reference
+#endif
+static uint16_t * cal_order;
+static int        cal_order_size; // Number of entries in `cal_order`
+static int        cal_order_cap;  // Number of entries allocated for `cal_order`
+
+
+static const cal_t * cal_entry(int ix) {
+  uint16_t ref = cal_order[ix];
+  return &cal_srcs[ref>>CAL_REF_SRC].list[ref&CAL_REF_IX];
+}
 
 
 int    cal_size() {
-  return cal_size_act;
+  return cal_order_size;
 }
 
 
-String cal_label(int ix) {
-  if( ix<0 || ix>=CAL_SIZE ) return "----";
-  return cal_list[ix].label;  
+const char * cal_label(int ix) {
+  if( ix<0 || ix>=cal_order_size ) return "----";
+  return &cal_srcs[cal_order[ix]>>CAL_REF_SRC].arena[cal_entry(ix)->label];
+}
+
+
+const char * cal_tag(int ix) {
+  if( ix<0 || ix>=cal_order_size ) return "";
+  const char * tag = cal_srcs[cal_order[ix]>>CAL_REF_SRC].tag;
+  return tag ? tag : "";
 }
 
 
 int    cal_year(int ix) {
-  if( ix<0 || ix>=CAL_SIZE ) return 1;
-  return cal_list[ix].year;  
+  if( ix<0 || ix>=cal_order_size ) return 1;
+  return cal_entry(ix)->year + 1900;
 }
 
 
 int    cal_month(int ix) {
-  if( ix<0 || ix>=CAL_SIZE ) return 1;
-  return cal_list[ix].month;  
+  if( ix<0 || ix>=cal_order_size ) return 1;
+  return cal_entry(ix)->monthday >> 5;
 }
 
 
 int    cal_day(int ix) {
-  if( ix<0 || ix>=CAL_SIZE ) return 1;
-  return cal_list[ix].day;  
+  if( ix<0 || ix>=cal_order_size ) return 1;
+  return cal_entry(ix)->monthday & 0x1F;
 }
 
 
@@ -64,189 +166,587 @@ int cal_daynum(int month, int day ) {
 }
 
 
-// Returns index of largest record that is today (mont/day passed) or later
-int    cal_findfirst(int month, int day) {
-  int today = cal_daynum(month,day);
-  int ix = 0;
-  while( ix<cal_size_act && cal_daynum(cal_list[ix].month,cal_list[ix].day)<today ) ix++;
-  if( ix==cal_size_act ) ix = 0; // wrap around
-  return ix;
+// Returns the slot for `month`/`day`: the day of the year (0-based) in a leap year, so 29 Feb has its own slot (59).
+static int cal_slot(int month, int day) {
+  static const int num[12] = {0, 31, 60, 91, 121, 152, 182, 213, 244, 274, 305, 335 };
+  return num[month-1]+day-1;
 }
 
 
-static int cal_getfile(const char * url, String & filecontent) {
-  // Function either returns 0 (ok case, `filecontent` has content)
-  // or returns an error code (and filecontent is "")
-  filecontent = "";
-  
-  // We need to specify which headers we want to look at (only: location for redirect)
-  static const char * headerkeys[] = {"location"} ;
-  static const size_t headercount = sizeof(headerkeys)/sizeof(const char *);
+// Returns the slot for day `doy` (0-based day of the year) in a year that is `leap` or not.
+static int cal_doy2slot(int doy, bool leap) {
+  return ( leap || doy<59 ) ? doy : doy+1; // skip the 29 Feb slot in a non-leap year
+}
 
-  // We need an SSL client, because google sheets uses https (but we don't care about the server fingerprint)
-  std::unique_ptr<BearSSL::WiFiClientSecure> client(new BearSSL::WiFiClientSecure);
-  client->setInsecure(); // happy to ignore the SSL certificate, else client->setFingerprint(uint8_t[20]);
-  HTTPClient https;
 
-  // Setup the request
-  bool ok = https.begin(*client, url);
-  https.collectHeaders(headerkeys,headercount);
-  if( !ok ) {
-    Serial.printf("ERROR cal unable to begin\n");
-    return CAL_ERROR_BEGIN;
-  } 
+// Returns the day of the year (0-based) of the entries in `slot`, in a year that is `leap` or not.
+static int cal_slot2doy(int slot, bool leap) {
+  return ( leap || slot<=59 ) ? slot : slot-1; // in a non-leap year, 29 Feb birthdays are celebrated on 1 Mar
+}
 
-  // Get the response
-  int httpCode = https.GET();
 
-  // GET failed?
-  if( httpCode<0 ) {
-    https.end();
-    Serial.printf("ERROR cal load '%s' (%d)\n", https.errorToString(httpCode).c_str(), httpCode );
-    return httpCode; 
-  }
+static bool cal_isleap(int year) {
+  return (year%4==0 && year%100!=0) || year%400==0;
+}
+
+
+// For each slot (day of a leap year), the index of the first entry in that slot or later; built after every sort.
+// So the entries of slot s are cal_index[s] .. cal_index[s+1]-1 (cal_index[366] is cal_order_size).
+#define CAL_SLOTS 366
+static uint16_t cal_index[CAL_SLOTS+1];
 
-  // GET successful
-  if( httpCode == HTTP_CODE_OK ) {
-    filecontent = https.getString();
-    https.end();
-    return 0;
-  } 
-
-  // Not redirect, bail out
-  if( httpCode!=HTTP_CODE_TEMPORARY_REDIRECT ) {
-    // Don't know how to handle
-    https.end();
-    Serial.printf("ERROR cal http %d\n", httpCode );
-    return -httpCode; // Make negative (positives are for parsing)
-  }
 
-  // Extract the temporary location (url) for the redirect
-  String location = https.header("location");
-  // New https request
-  https.end();
-  ok = https.begin(*client, location);
-  if( !ok ) {
-    Serial.printf("ERROR cal unable to begin redirect\n");
-    return CAL_ERROR_BEGIN;
+// Builds cal_index from the (merged) cal_order
+static void cal_index_build() {
+  int ix = 0;
+  for( int slot=0; slot<CAL_SLOTS; slot++ ) {
+    while( ix<cal_order_size && cal_slot(cal_month(ix),cal_day(ix))<slot ) ix++;
+    cal_index[slot] = ix;
   }
-  httpCode = https.GET();
-  if( httpCode == HTTP_CODE_OK  ) {
-    filecontent = https.getString();
-    https.end();
-    return 0;
+  cal_index[CAL_SLOTS] = cal_order_size;
+}
+
+
+// Returns index of largest record that is today (mont/day passed) or later
+int    cal_findfirst(int month, int day) {
+  int ix = cal_index[cal_slot(month,day)];
+  if( ix==cal_order_size ) ix = 0; // wrap around
+  return ix;
+}
+
+
+// The window consists of at most two spans of slots: the rest of this year and the begin of next year.
+typedef struct cal_span_s {
+  int  ix;     // Next entry to return
+  int  ixend;  // One past the last entry of this span
+  bool leap;   // The year of this span is a leap year
+  int  offset; // Add to the day of the year of an entry to get the days until its birthday
+  int  year;   // The year of this span
+} cal_span_t;
+static cal_span_t cal_window_spans[2];
+static int        cal_window_span; // Span being iterated
+static int        cal_window_count;// Number of spans
+
+
+// Sets `span` to iterate the entries of the days `doy1`..`doy2` (0-based, inclusive) of `year`.
+static void cal_window_set(cal_span_t * span, int year, int doy1, int doy2, int offset) {
+  span->leap = cal_isleap(year);
+  span->year = year;
+  span->offset = offset;
+  int slot1 = cal_doy2slot(doy1,span->leap);
+  if( !span->leap && doy1==59 ) slot1 = 59; // 1 Mar in a non-leap year, also has the 29 Feb birthdays
+  span->ix = cal_index[slot1];
+  span->ixend = cal_index[cal_doy2slot(doy2,span->leap)+1];
+}
+
+
+void cal_window_begin(int year, int month, int day, int days) {
+  bool leap = cal_isleap(year);
+  int  yearlen = leap ? 366 : 365;
+  int  today = cal_slot2doy(cal_slot(month,day),leap); // 0-based day of the year
+  if( days>365 ) days = 365; // a year ahead at most, so that spans do not overlap
+  cal_window_span = 0;
+  cal_window_count = 0;
+  if( days<=0 || cal_order_size==0 ) return;
+  int last = today+days-1; // 0-based day (of this year, or beyond) of the last day in the window
+  cal_window_set( &cal_window_spans[cal_window_count++], year, today, min(last,yearlen-1), -today );
+  if( last>=yearlen ) cal_window_set( &cal_window_spans[cal_window_count++], year+1, 0, last-yearlen, yearlen-today );
+}
+
+
+int cal_window_next(int * daysuntil, int * age) {
+  while( cal_window_span<cal_window_count ) {
+    cal_span_t * span = &cal_window_spans[cal_window_span];
+    if( span->ix<span->ixend ) {
+      int ix = span->ix++;
+      if( daysuntil ) *daysuntil = cal_slot2doy(cal_slot(cal_month(ix),cal_day(ix)),span->leap) + span->offset;
+      if( age ) *age = span->year - cal_year(ix);
+      return ix;
+    }
+    cal_window_span++;
   }
-  https.end();
-  Serial.printf("ERROR cal redirect http %d\n", httpCode );
-  return -httpCode; // Make negative (positives are for parsing), 1000 lower (to show this is for redirect)
+  return -1;
 }
 
 
 // qsort requires you to create a sort function
 static int cal_lt(const void *cmp1, const void *cmp2) {
-  // Need to cast the void * to int *
-  cal_t * a = (cal_t *)cmp1;
-  cal_t * b = (cal_t *)cmp2;
-  // The comparison
-  if( a->month > b->month  ) return +1;
-  if( a->month < b->month  ) return -1;
-  if( a->day   > b->day    ) return +1;
-  if( a->day   < b->day    ) return -1;
+  // Need to cast the void * to cal_t *
+  const cal_t * a = (const cal_t *)cmp1;
+  const cal_t * b = (const cal_t *)cmp2;
+  // The comparison (monthday sorts on month, then day)
+  if( a->monthday > b->monthday ) return +1;
+  if( a->monthday < b->monthday ) return -1;
   // We don't care about year, but anyhow let's put oldest first
-  if( a->year  > b->year   ) return +1;
-  if( a->year  < b->year   ) return -1;
+  if( a->year     > b->year     ) return +1;
+  if( a->year     < b->year     ) return -1;
   return 0;
 }
 
-// 0 for no errors (added to cal_list_cal_size_act), otherwise error code
-static int cal_parseline(String content, int from, int till) {
-  // Last line is empty is ok
-  if( from==till ) return 0;
-  // find comma
-  int pos = content.indexOf(',',from);
-  //Serial.printf("\n'%s' #=%d %d..%d, ix=%d, /,/%d\n",content.c_str(),content.length(),from,till,ix, pos);
-  if( pos == -1 ) return 1; // missing comma in record
-  if( pos == 0 ) return 2; // missing name in record
-  if( pos+11 != till ) return 3; // date is not 10 long (or extra column on some record, giving all record including the first an extra column)
-  if( content[pos+5]!='-' ) return 4; // year-month dash missing
-  if( content[pos+8]!='-' ) return 5; // month-day dash missing
+
+// Merges the sorted runs of all sources into cal_order (the runs are not re-sorted), then builds the index.
+// With only a few runs, a linear scan of the run heads to find the smallest is the fastest k-way merge.
+static void cal_merge() {
+  int total = 0;
+  for( int src=0; src<CAL_SOURCES; src++ ) total += cal_srcs[src].size_act;
+  if( total>cal_order_cap ) {
+    uint16_t * order = (uint16_t *)realloc(cal_order, total*sizeof(uint16_t));
+    if( order!=0 ) { cal_order = order; cal_order_cap = total; }
+    else { Serial.printf("cal : ERROR no heap to merge %d entries\n",total); total = cal_order_cap; } // merge what fits
+  }
+  int head[CAL_SOURCES] = {0}; // Next entry of each run
+  cal_order_size = 0;
+  while( cal_order_size<total ) {
+    int best = -1;
+    for( int src=0; src<CAL_SOURCES; src++ ) {
+      if( head[src]==cal_srcs[src].size_act ) continue;
+      if( best<0 || cal_lt(&cal_srcs[src].list[head[src]],&cal_srcs[best].list[head[best]])<0 ) best = src;
+    }
+    cal_order[cal_order_size++] = (best<<CAL_REF_SRC) | head[best]++;
+  }
+  cal_index_build();
+}
+
+
+// The CSV file is parsed while it is being downloaded, one character at a time.
+// Only the record under construction is buffered, so RAM use does not depend on the file size.
+#define CAL_LABEL_SIZE 32 // Longer labels are truncated (the display has only 4 digits anyhow)
+#define CAL_DATE_SIZE  10 // YYYY-MM-DD
+static char cal_parse_label[CAL_LABEL_SIZE]; // Label of the record being parsed (not zero terminated)
+static int  cal_parse_labellen;              // Number of chars in `cal_parse_label`
+static char cal_parse_date[CAL_DATE_SIZE];   // First chars of the date of the record being parsed (not zero terminated)
+static int  cal_parse_datelen;               // Number of chars after the comma (may exceed CAL_DATE_SIZE)
+static bool cal_parse_comma;                 // Comma seen in the record being parsed
+static bool cal_parse_cr;                    // Last char was \r (might be the start of the \r\n line separator)
+static int  cal_parse_error;                 // First parse error (1..9) or 0 if none
+
+
+// Starts a new parse (does not clear the store)
+static void cal_parse_begin() {
+  cal_parse_labellen = 0;
+  cal_parse_datelen = 0;
+  cal_parse_comma = false;
+  cal_parse_cr = false;
+  cal_parse_error = 0;
+}
+
+
+// Parses the record collected so far and prepares for the next one.
+// Returns 0 for no errors (added to the store), otherwise error code.
+static int cal_parse_record() {
+  int  labellen = cal_parse_labellen;
+  int  datelen = cal_parse_datelen;
+  bool comma = cal_parse_comma;
+  const char * date = cal_parse_date;
+  cal_parse_labellen = 0;
+  cal_parse_datelen = 0;
+  cal_parse_comma = false;
+  // Empty line is ok
+  if( labellen==0 && !comma ) return 0;
+  if( !comma ) return 1; // missing comma in record
+  if( labellen==0 ) return 2; // missing name in record
+  if( datelen!=CAL_DATE_SIZE ) return 3; // date is not 10 long (or extra column on some record, giving all record including the first an extra column)
+  if( date[4]!='-' ) return 4; // year-month dash missing
+  if( date[7]!='-' ) return 5; // month-day dash missing
   // Extract year
-  int year = content[pos+1]-'0';
-  year = year*10 + content[pos+2]-'0';
-  year = year*10 + content[pos+3]-'0';
-  year = year*10 + content[pos+4]-'0';
+  int year = date[0]-'0';
+  year = year*10 + date[1]-'0';
+  year = year*10 + date[2]-'0';
+  year = year*10 + date[3]-'0';
   if( year<1900 || year>2100 ) return 6; // year out of range
   // Extract month
-  int month = content[pos+6]-'0';
-  month = month*10 + content[pos+7]-'0';
+  int month = date[5]-'0';
+  month = month*10 + date[6]-'0';
   if( month<1 || month>12 ) return 7; // month out of range
   // Extract day
-  int day = content[pos+9]-'0';
-  day = day*10 + content[pos+10]-'0';
+  int day = date[8]-'0';
+  day = day*10 + date[9]-'0';
   if( day<1 || day>cal_days_in_month(month) ) return 8; // day out of range
-  // Space
-  if( cal_size_act==CAL_SIZE ) return 9; // out of space
-  // Fill record
-  cal_list[cal_size_act].label= content.substring(from,pos);
-  cal_list[cal_size_act].year=year;
-  cal_list[cal_size_act].month=month;
-  cal_list[cal_size_act].day=day;
-  cal_size_act = cal_size_act+1;
-  return 0;
+  // Fill record (9 if out of space)
+  if( labellen>CAL_LABEL_SIZE-1 ) labellen = CAL_LABEL_SIZE-1; // truncate
+  return cal_store_add(cal_parse_label, labellen, year, month, day);
+}
+
+
+// Adds `ch` to the record being parsed (label before the first comma, date after it)
+static void cal_parse_add(char ch) {
+  if( cal_parse_comma ) {
+    if( cal_parse_datelen<CAL_DATE_SIZE ) cal_parse_date[cal_parse_datelen] = ch;
+    cal_parse_datelen++; // keep counting, so that a too long date is detected
+  } else if( ch==',' ) {
+    cal_parse_comma = true;
+  } else {
+    if( cal_parse_labellen<CAL_LABEL_SIZE-1 ) cal_parse_label[cal_parse_labellen] = ch;
+    cal_parse_labellen++;
+  }
 }
 
 
-static int cal_parse(String content) {
-  int from = 0;
-  int pos;
-  while( (pos=content.indexOf("\r\n",from)) >= 0 ) {
-    int res = cal_parseline(content, from, pos);
-    if( res>0 ) return res;
-    from = pos+2;
+// Feeds one char of the file to the parser; records are separated by \r\n
+static void cal_parse_char(char ch) {
+  if( cal_parse_error ) return;
+  if( cal_parse_cr ) {
+    cal_parse_cr = false;
+    if( ch=='\n' ) { cal_parse_error = cal_parse_record(); return; }
+    cal_parse_add('\r'); // a lone \r is part of the record
   }
+  if( ch=='\r' ) cal_parse_cr = true; else cal_parse_add(ch);
+}
+
+
+// Ends the parse, returns 0 for no errors, otherwise the (first) error code (1..9)
+static int cal_parse_end() {
+  if( cal_parse_error ) return cal_parse_error;
   // Last line typically has no CR LF
-  return cal_parseline(content, from, content.length());
+  if( cal_parse_cr ) { cal_parse_cr = false; cal_parse_add('\r'); }
+  cal_parse_error = cal_parse_record();
+  return cal_parse_error;
 }
 
 
-int cal_load(const char * url) {
-  // Clear existing list
-  cal_size_act = 0;
-  
-  // First download calendar
-  String content;
-  int error1 = cal_getfile(url,content);
-  if( error1>0 ) { Serial.printf("cal : ERROR code expected to be negative (%d)",error1 ); return CAL_ERROR_UNEXPECTED; }
-  if( error1!=0 ) return error1;
-  
-  // Next, parse the file content
-  int error2 = cal_parse(content);
+// The fetch writes the downloaded file to this sink, one received chunk per load step.
+class CalParseSink : public Print {
+  public:
+    bool expected = false; // The store was cleared (by expect) for new content
+    void expect(int filesize) {
+      cal_store_clear(filesize); // size the store for the file that will be written
+      expected = true;
+    }
+    size_t write(uint8_t ch) override { 
+      return write(&ch,1); 
+    }
+    size_t write(const uint8_t * buf, size_t size) override {
+      for( size_t i=0; i<size; i++ ) cal_parse_char(buf[i]);
+      return cal_parse_error ? 0 : size; // Accepting less aborts the download: no need to continue after a parse error
+    }
+};
+
+
+// Returns the (FNV-1a) hash of `url`, used to check that the store and cache belong to the configured url.
+static uint32_t cal_hash(const char * url) {
+  uint32_t hash = 2166136261u;
+  while( *url ) hash = (hash ^ (uint8_t)*url++) * 16777619u;
+  return hash;
+}
+
+
+// The parsed calendar (per source: store and validators) is cached in a file, so that it is available at boot,
+// and so that a reload can be skipped when the server reports the sheet is not modified.
+#define CAL_CACHE_FILE  "/cal%d.bin" // %d is the source number
+#define CAL_CACHE_TEMP  "/cal.tmp"
+#define CAL_CACHE_OLD   "/cal.bin"   // Cache file of the single source version, removed at init
+#define CAL_CACHE_MAGIC 0x324C4362 // "bCL2"
+typedef struct cal_cache_s {
+  uint32_t magic;                       // CAL_CACHE_MAGIC (also changes when the layout changes)
+  uint32_t crc;                         // Of the records and the labels, so that a damaged file is rejected
+  uint32_t urlhash;                     // Hash of the url the calendar was loaded from
+  uint16_t size;                        // Number of entries (cal_t records following this header)
+  uint16_t arena;                       // Number of label bytes (following the records)
+  char     etag[CAL_VALIDATOR_SIZE];    // Validators of the calendar
+  char     lastmod[CAL_VALIDATOR_SIZE];
+} cal_cache_t;
+static bool cal_cache_ok; // LittleFS is mounted
+
+
+// Returns the name of the cache file of the source being loaded
+static const char * cal_cache_file() {
+  static char name[sizeof(CAL_CACHE_FILE)+10]; // %d expands to at most 11 chars
+  snprintf(name, sizeof(name), CAL_CACHE_FILE, (int)(cal_src-cal_srcs)+1);
+  return name;
+}
+
+
+// Computes the crc of the records and labels of the store (as they are in the cache file)
+static uint32_t cal_cache_crc(int size, int arena) {
+  return crc32(cal_src->arena, arena, crc32(cal_src->list, size*sizeof(cal_t)));
+}
+
+
+// Returns true if the records of the store, as restored from the cache, only refer to labels in the arena, and have a valid date
+static bool cal_cache_valid(int size, int arena) {
+  if( size>0 && (arena==0 || cal_src->arena[arena-1]!='\0') ) return false; // last label must be terminated
+  for( int i=0; i<size; i++ ) {
+    const cal_t * entry = &cal_src->list[i];
+    int month = entry->monthday >> 5;
+    int day = entry->monthday & 0x1F;
+    if( entry->label>=arena || day<1 || day>cal_days_in_month(month) ) return false;
+  }
+  return true;
+}
+
+
+// Saves the store to the cache file (writes a temp file first, so that a power loss leaves the old cache intact)
+static void cal_cache_save() {
+  if( !cal_cache_ok ) return;
+  cal_cache_t header;
+  header.magic = CAL_CACHE_MAGIC;
+  header.crc = cal_cache_crc(cal_src->size_act, cal_src->arena_used);
+  header.urlhash = cal_src->urlhash;
+  header.size = cal_src->size_act;
+  header.arena = cal_src->arena_used;
+  memcpy(header.etag, cal_src->etag, CAL_VALIDATOR_SIZE);
+  memcpy(header.lastmod, cal_src->lastmod, CAL_VALIDATOR_SIZE);
+  File file = LittleFS.open(CAL_CACHE_TEMP, "w");
+  if( !file ) { Serial.printf("cal : ERROR cache create\n"); return; }
+  size_t len = file.write((const uint8_t *)&header, sizeof(header));
+  len += file.write((const uint8_t *)cal_src->list, cal_src->size_act*sizeof(cal_t));
+  len += file.write((const uint8_t *)cal_src->arena, cal_src->arena_used);
+  file.close();
+  if( len!=sizeof(header)+cal_src->size_act*sizeof(cal_t)+cal_src->arena_used ) { Serial.printf("cal : ERROR cache write\n"); LittleFS.remove(CAL_CACHE_TEMP); return; }
+  LittleFS.remove(cal_cache_file());
+  LittleFS.rename(CAL_CACHE_TEMP, cal_cache_file());
+  Serial.printf("cal : cached %d in %s (%u bytes)\n", cal_src->size_act, cal_cache_file(), (unsigned)len);
+}
+
+
+// Loads the store from the cache file, if that was saved for the url of the source
+static int cal_cache_restore() {
+  cal_store_clear(-1);
+  cal_src->urlhash = 0;
+  cal_src->etag[0] = '\0';
+  cal_src->lastmod[0] = '\0';
+  if( !cal_cache_ok ) return CAL_ERROR_CACHE;
+  if( cal_src->url==0 || cal_src->url[0]=='\0' ) return CAL_ERROR_CACHE;
+  File file = LittleFS.open(cal_cache_file(), "r");
+  if( !file ) { Serial.printf("cal : no cache %s\n",cal_cache_file()); return CAL_ERROR_CACHE; }
+  cal_cache_t header;
+  int error = 0;
+  if( file.read((uint8_t *)&header, sizeof(header))!=(int)sizeof(header) ) error = 1;
+  else if( header.magic!=CAL_CACHE_MAGIC ) error = 2;
+  else if( header.urlhash!=cal_hash(cal_src->url) ) error = 3; // cache is for another url
+  else if( !cal_store_reserve(header.size, header.arena) ) error = 4;
+  else if( file.read((uint8_t *)cal_src->list, header.size*sizeof(cal_t))!=(int)(header.size*sizeof(cal_t)) ) error = 5;
+  else if( file.read((uint8_t *)cal_src->arena, header.arena)!=(int)header.arena ) error = 6;
+  else if( header.crc!=cal_cache_crc(header.size, header.arena) ) error = 7;
+  else if( !cal_cache_valid(header.size, header.arena) ) error = 8;
+  file.close();
+  if( error ) { Serial.printf("cal : cache %s not used (%d)\n",cal_cache_file(),error); return CAL_ERROR_CACHE; }
+  cal_src->size_act = header.size; // cache is sorted
+  cal_src->arena_used = header.arena;
+  cal_src->urlhash = header.urlhash;
+  memcpy(cal_src->etag, header.etag, CAL_VALIDATOR_SIZE);
+  memcpy(cal_src->lastmod, header.lastmod, CAL_VALIDATOR_SIZE);
+  cal_src->etag[CAL_VALIDATOR_SIZE-1] = '\0';
+  cal_src->lastmod[CAL_VALIDATOR_SIZE-1] = '\0';
+  Serial.printf("cal : restored %d from %s\n",cal_src->size_act,cal_cache_file());
+  return 0;
+}
+
+
+void cal_source_set(int src, const char * url, const char * tag) {
+  if( src<0 || src>=CAL_SOURCES ) return;
+  cal_srcs[src].url = url;
+  cal_srcs[src].tag = tag;
+}
+
+
+int cal_restore() {
+  int restored = 0;
+  for( int src=0; src<CAL_SOURCES; src++ ) {
+    cal_src = &cal_srcs[src];
+    if( cal_cache_restore()==0 ) restored++;
+  }
+  cal_merge();
+  return restored>0 ? 0 : CAL_ERROR_CACHE;
+}
+
+
+// A load is a sequence of steps, each doing a bounded amount of work, so that the caller keeps running.
+// The sources are loaded one after the other, each into its own run; the runs are merged at the end.
+typedef enum cal_load_state_e {
+  CAL_LOAD_IDLE,    // No load busy
+  CAL_LOAD_NEXT,    // Start loading the next source
+  CAL_LOAD_HEADERS, // Fetch steps till the response headers are in
+  CAL_LOAD_BODY,    // Fetch steps (each step parses the received chunk into the store)
+  CAL_LOAD_SORT,    // Body is in (or failed), sort the run
+  CAL_LOAD_SAVE,    // Run is ok, save it to the cache file
+  CAL_LOAD_MERGE,   // All sources done, merge the runs
+} cal_load_state_t;
+static cal_load_state_t cal_load_state;
+static CalParseSink     cal_load_sink;
+static int              cal_load_result;     // Result of the first source that failed (0 if none)
+static uint32_t         cal_load_urlhash;    // Hash of the url being loaded
+static bool             cal_load_conditional;// Validators of the store were sent
+static int              cal_load_error;      // Result of the download (for the sort step)
+static uint32_t         cal_load_ms;         // Start time of the load
+static int              cal_load_src;        // Index of the source being loaded (-1 before the first)
+
+
+// Terminates the load of a source with download result `error1` (0, CAL_NOTMODIFIED or negative), combining it with the parse result.
+// Returns 0 for ok, or the error of the source. A failing source keeps its previous run when its store was not overwritten,
+// falls back to its cache when it was partially overwritten, or keeps the records till a parse error.
+#define CAL_NOTMODIFIED 2
+static int cal_load_finish(int error1) {
+  cal_load_state = CAL_LOAD_NEXT;
+  if( error1==CAL_NOTMODIFIED ) { Serial.printf("cal : not modified, kept %d\n",cal_src->size_act); return 0; }
+  int error2 = cal_parse_error; // A parse error aborts the download, so check that first
+  if( error1==0 ) error2 = cal_parse_end(); // Only a complete file has a valid last record
   // Sort even on error, so that the part till the error is usable
-  qsort( cal_list, cal_size_act, sizeof(cal_list[0]), cal_lt );
+  if( cal_load_sink.expected ) qsort( cal_src->list, cal_src->size_act, sizeof(cal_t), cal_lt );
   if( !( 0<=error2 && error2<10 ) ) { Serial.printf("cal : ERROR code expected to be 1..9 (%d)",error2 ); return CAL_ERROR_UNEXPECTED; }
-  if( error2!=0 ) { int report = 10*(cal_size_act+1) + error2; Serial.printf("cal : record %d has error %d\n",cal_size_act+1,error2); return report; }
+  if( error2!=0 ) { int report = 10*(cal_src->size_act+1) + error2; Serial.printf("cal : record %d has error %d\n",cal_src->size_act+1,error2); return report; }
+  if( error1>0 ) { Serial.printf("cal : ERROR code expected to be negative (%d)",error1 ); return CAL_ERROR_UNEXPECTED; }
+  if( error1!=0 && !cal_load_sink.expected ) return error1; // store untouched
+  if( error1!=0 ) { cal_cache_restore(); return error1; } // store partially overwritten, fall back to the cache
 
   // Do we have a calendar?
-  if( cal_size_act==0 ) { Serial.printf("ERROR cal empty\n"); return CAL_EMPTY; }
+  if( cal_src->size_act==0 ) { Serial.printf("ERROR cal empty\n"); return CAL_EMPTY; }
 
   // Feedback
-  Serial.printf("cal : loaded %d\n",cal_size_act);
+  Serial.printf("cal : loaded %d (%d bytes, store %d+%d bytes, %lu ms)\n",cal_src->size_act,fetch_received(),cal_src->size_cap*(int)sizeof(cal_t),cal_src->arena_cap,(unsigned long)(millis()-cal_load_ms));
 
+  // Keep it for the next boot, and for the next conditional load
+  cal_src->urlhash = cal_load_urlhash;
+  if( cal_cache_ok ) cal_load_state = CAL_LOAD_SAVE;
   return 0;
 }
 
 
+// Starts the load of the source cal_src
+static void cal_load_source() {
+  // Response headers we need (in fetch_header order)
+  static const char * headerkeys[] = {"etag", "last-modified"} ;
+  static const int headercount = sizeof(headerkeys)/sizeof(const char *);
+
+  // Validators are only sent when the store holds the calendar of this url
+  cal_load_urlhash = cal_hash(cal_src->url);
+  cal_load_conditional = cal_src->size_act>0 && cal_src->urlhash==cal_load_urlhash;
+  String extra;
+  if( cal_load_conditional && cal_src->etag[0]!='\0' ) extra = extra + "If-None-Match: " + cal_src->etag + "\r\n";
+  if( cal_load_conditional && cal_src->lastmod[0]!='\0' ) extra = extra + "If-Modified-Since: " + cal_src->lastmod + "\r\n";
+
+  // The sink clears and sizes the store when the file arrives
+  cal_load_sink.expected = false;
+  cal_parse_begin();
+  cal_load_ms = millis();
+  Serial.printf("cal : source %d\n",(int)(cal_src-cal_srcs)+1);
+  if( fetch_begin(cal_src->url, extra.c_str(), headerkeys, headercount) ) {
+    cal_load_state = CAL_LOAD_HEADERS;
+  } else {
+    Serial.printf("ERROR cal unable to begin\n");
+    cal_load_state = CAL_LOAD_SORT;
+    cal_load_error = CAL_ERROR_BEGIN;
+  }
+}
+
+
+void cal_load_begin() {
+  // A load that is still busy is aborted
+  if( cal_load_state!=CAL_LOAD_IDLE ) {
+    fetch_end();
+    if( cal_load_sink.expected && (cal_load_state==CAL_LOAD_BODY || cal_load_state==CAL_LOAD_SORT) ) cal_cache_restore(); // store partially overwritten
+    Serial.printf("cal : load aborted\n");
+  }
+  // Sources that are no longer used are dropped
+  for( int src=0; src<CAL_SOURCES; src++ ) {
+    cal_src = &cal_srcs[src];
+    if( cal_src->url==0 || cal_src->url[0]=='\0' ) { cal_store_clear(-1); cal_src->urlhash = 0; }
+  }
+  cal_merge();
+  cal_load_src = -1; // CAL_LOAD_NEXT goes to the first source
+  cal_load_result = 0;
+  cal_load_state = CAL_LOAD_NEXT;
+}
+
+
+int cal_load_step() {
+  int res;
+  switch( cal_load_state ) {
+    case CAL_LOAD_IDLE:
+      return CAL_ERROR_UNEXPECTED;
+    case CAL_LOAD_NEXT:
+      do cal_load_src++; while( cal_load_src<CAL_SOURCES && (cal_srcs[cal_load_src].url==0 || cal_srcs[cal_load_src].url[0]=='\0') );
+      if( cal_load_src==CAL_SOURCES ) { cal_load_state = CAL_LOAD_MERGE; return CAL_BUSY; }
+      cal_src = &cal_srcs[cal_load_src];
+      cal_load_source();
+      return CAL_BUSY;
+    case CAL_LOAD_HEADERS:
+      res = fetch_step(0);
+      if( res==FETCH_BUSY ) return CAL_BUSY;
+      if( res==FETCH_HEADERS && fetch_status()==HTTP_CODE_OK ) {
+        // Validators of the new content, and its size
+        strlcpy(cal_src->etag, fetch_header(0), CAL_VALIDATOR_SIZE);
+        strlcpy(cal_src->lastmod, fetch_header(1), CAL_VALIDATOR_SIZE);
+        if( strlen(fetch_header(0))>=CAL_VALIDATOR_SIZE ) cal_src->etag[0] = '\0';
+        if( strlen(fetch_header(1))>=CAL_VALIDATOR_SIZE ) cal_src->lastmod[0] = '\0';
+        cal_src->urlhash = 0; // store content is unknown until the load completes
+        cal_order_size = 0; // the merged view refers to the run that is about to be overwritten
+        cal_index_build();
+        cal_load_sink.expect(fetch_size());
+        cal_load_state = CAL_LOAD_BODY;
+        return CAL_BUSY;
+      }
+      if( res==FETCH_HEADERS ) {
+        fetch_end();
+        if( fetch_status()==HTTP_CODE_NOT_MODIFIED && cal_load_conditional ) res = CAL_NOTMODIFIED;
+        else { Serial.printf("ERROR cal http %d\n", fetch_status() ); res = -fetch_status(); } // Make negative (positives are for parsing)
+      }
+      if( res==FETCH_ERROR_REDIRECT ) res = CAL_ERROR_BEGIN_REDIRECT;
+      cal_load_error = res;
+      cal_load_state = CAL_LOAD_SORT;
+      return CAL_BUSY;
+    case CAL_LOAD_BODY:
+      res = fetch_step(&cal_load_sink);
+      if( res==FETCH_BUSY ) return CAL_BUSY;
+      cal_load_error = res; // FETCH_DONE (0) or an error
+      cal_load_state = CAL_LOAD_SORT;
+      return CAL_BUSY;
+    case CAL_LOAD_SORT:
+      res = cal_load_finish(cal_load_error);
+      if( res!=0 && cal_load_result==0 ) cal_load_result = res; // the other sources are still loaded
+      return CAL_BUSY;
+    case CAL_LOAD_SAVE:
+      cal_cache_save();
+      cal_load_state = CAL_LOAD_NEXT;
+      return CAL_BUSY;
+    case CAL_LOAD_MERGE:
+      cal_merge();
+      cal_load_state = CAL_LOAD_IDLE;
+      Serial.printf("cal : merged %d\n",cal_order_size);
+      return cal_load_result;
+  }
+  return CAL_ERROR_UNEXPECTED;
+}
+
+
+int cal_load_received() {
+  return cal_load_state==CAL_LOAD_BODY ? fetch_received() : 0;
+}
+
+
+int cal_load() {
+  cal_load_begin();
+  int error;
+  while( (error=cal_load_step())==CAL_BUSY ) yield();
+  return error;
+}
+
+
 #if CAL_INCLUDE_TEST
-  static int cal_test(int id,String content,int expect,int xsize) {
-    int actual = cal_load(content);
-    int ok = (expect==actual) && (xsize==cal_size_act);
-    Serial.printf("%3d %d=%d %d=%d %s\n",id,expect,actual,xsize,cal_size_act,ok?"ok":"FAIL");
+  static int cal_test(int id,const char * content,int expect,int xsize) {
+    cal_store_clear(-1);
+    cal_parse_begin();
+    while( *content ) cal_parse_char(*content++);
+    int actual = cal_parse_end();
+    int ok = (expect==actual) && (xsize==cal_src->size_act);
+    Serial.printf("%3d %d=%d %d=%d %s\n",id,expect,actual,xsize,cal_src->size_act,ok?"ok":"FAIL");
+    if( cal_src->size_act>0 ) qsort( cal_src->list, cal_src->size_act, sizeof(cal_t), cal_lt );
+    return !ok;
+  }
+  static int cal_test_window(int id,int year,int month,int day,int days,const char * expect) {
+    char actual[64] = "";
+    cal_window_begin(year,month,day,days);
+    int ix, daysuntil, age;
+    while( (ix=cal_window_next(&daysuntil,&age))>=0 ) sprintf(actual+strlen(actual),"%s%s%s%d/%d",actual[0]?" ":"",cal_tag(ix),cal_label(ix),daysuntil,age);
+    int ok = strcmp(expect,actual)==0;
+    Serial.printf("%3d %s=%s %s\n",id,expect,actual,ok?"ok":"FAIL");
     return !ok;
   }
   static void cal_tests() {
     Serial.printf("=== CAL TESTING BEGIN ===\n");
     int id=0;
     int error_count=0;
+    cal_src = &cal_srcs[0];
     error_count += cal_test(id++,"mike1;1978-10-17",1,0);
     error_count += cal_test(id++,",1978-10-17",2,0);
     error_count += cal_test(id++,"1,1978-10-17",0,1);
@@ -267,6 +767,32 @@ int cal_load(const char * url) {
     error_count += cal_test(id++,"mr,1978-10-00\r\n",8,0);
     error_count += cal_test(id++,"mr,1978-10-32\r\n",8,0);
     error_count += cal_test(id++,"mr,1978-10-17\r\nannie,2002-07-02\r\nboris,1999-02-04",0,3);
+    error_count += cal_test(id++,"mr,1978-10-17\r\n\r\nannie,2002-07-02",0,2);
+    error_count += cal_test(id++,"a-very-long-name-that-does-not-fit-the-label-buffer,1978-10-17",0,1);
+    error_count += cal_test(id++,"mr,1978-10-17\r\nann,2002-07-02,x",3,1);
+    // Window, including leap days and year wrap
+    error_count += cal_test(id++,"a,2000-02-29\r\nb,1990-03-01\r\nc,1980-12-31\r\nd,1970-01-01\r\ne,1960-02-28",0,5);
+    cal_merge();
+    error_count += cal_test_window(id++,2023, 2,28,2,"e0/63 a1/23 b1/33");
+    error_count += cal_test_window(id++,2024, 2,28,2,"e0/64 a1/24");
+    error_count += cal_test_window(id++,2023, 3, 1,1,"a0/23 b0/33");
+    error_count += cal_test_window(id++,2024, 3, 1,1,"b0/34");
+    error_count += cal_test_window(id++,2023,12,31,2,"c0/43 d1/54");
+    error_count += cal_test_window(id++,2023, 6, 1,0,"");
+    error_count += cal_test_window(id++,2023, 3, 2,365,"c304/43 d305/54 e363/64 a364/24");
+    // Merge of sources, with tags (the test sources have no url)
+    cal_srcs[1].tag = "*";
+    cal_srcs[2].tag = "#";
+    cal_src = &cal_srcs[1];
+    error_count += cal_test(id++,"x,1961-02-28\r\ny,1999-12-31\r\nz,2001-01-01",0,3);
+    cal_src = &cal_srcs[2];
+    error_count += cal_test(id++,"p,2000-03-01\r\nq,1959-02-28",0,2);
+    cal_merge();
+    error_count += cal_test_window(id++,2023,12,31,3,"c0/43 *y0/24 d1/54 *z1/23");
+    error_count += cal_test_window(id++,2023, 2,28,2,"#q0/64 e0/63 *x0/62 a1/23 b1/33 #p1/23");
+    for( int src=0; src<CAL_SOURCES; src++ ) { cal_src = &cal_srcs[src]; cal_store_clear(-1); cal_src->tag = 0; }
+    cal_src = &cal_srcs[0];
+    cal_merge();
     Serial.printf("Errors %d\n",error_count);
     Serial.printf("=== CAL TESTING END ===\n");
   }
@@ -275,7 +801,56 @@ int cal_load(const char * url) {
 #endif
 
 
+#if CAL_INCLUDE_BENCH
+  // Parses `rows` generated records, then times the sort and a lookup for every day of the year
+  static void cal_bench_rows(int rows) {
+    char line[32];
+    uint32_t t0 = micros();
+    cal_store_clear(-1);
+    cal_parse_begin();
+    for( int i=0; i<rows; i++ ) {
+      int len = sprintf(line,"name%d,%04d-%02d-%02d\r\n", i, 1930+i%90, 1+i*7%12, 1+i*13%28);
+      for( int j=0; j<len; j++ ) cal_parse_char(line[j]);
+      if( i%100==0 ) yield(); // keep the watchdog happy
+    }
+    int error = cal_parse_end();
+    uint32_t t1 = micros();
+    qsort( cal_src->list, cal_src->size_act, sizeof(cal_t), cal_lt );
+    cal_merge();
+    uint32_t t2 = micros();
+    int sum = 0;
+    for( int month=1; month<=12; month++ ) 
+      for( int day=1; day<=cal_days_in_month(month); day++ ) sum += cal_findfirst(month,day);
+    uint32_t t3 = micros();
+    int count = 0;
+    for( int month=1; month<=12; month++ ) 
+      for( int day=1; day<=cal_days_in_month(month); day++ ) {
+        cal_window_begin(2024,month,day,7);
+        while( cal_window_next(0,0)>=0 ) count++;
+      }
+    uint32_t t4 = micros();
+    Serial.printf("cal : bench %4d rows: error %d, parse %lu us, sort %lu us, 366 lookups %lu us (%d), 366 windows %lu us (%d), store %d+%d bytes\n", 
+      rows, error, (unsigned long)(t1-t0), (unsigned long)(t2-t1), (unsigned long)(t3-t2), sum, (unsigned long)(t4-t3), count, cal_src->size_cap*(int)sizeof(cal_t), cal_src->arena_cap );
+  }
+  static void cal_bench() {
+    Serial.printf("=== CAL BENCH BEGIN ===\n");
+    cal_src = &cal_srcs[0];
+    cal_bench_rows(100);
+    cal_bench_rows(1000);
+    cal_bench_rows(5000);
+    cal_store_clear(-1);
+    cal_merge();
+    Serial.printf("=== CAL BENCH END ===\n");
+  }
+#else
+  #define cal_bench() (void)0
+#endif
+
+
 void cal_init() {
   cal_tests();
-  Serial.printf("cal : init\n");
+  cal_bench();
+  cal_cache_ok = LittleFS.begin();
+  if( cal_cache_ok && LittleFS.remove(CAL_CACHE_OLD) ) Serial.printf("cal : removed old cache %s\n", CAL_CACHE_OLD);
+  Serial.printf("cal : init (cache %s)\n", cal_cache_ok ? "on" : "off, no file system");
 }
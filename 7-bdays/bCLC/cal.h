@@ -3,16 +3,25 @@
 #define _CAL_H_
 
 
-// Maximum number of calendar entries
-#define CAL_SIZE 100
+// Maximum number of calendar entries per source (the store is allocated on the heap, sized at load time)
+#define CAL_SIZE_MAX 8000
+// Number of calendar sources (urls); their entries are merged into one calendar
+#define CAL_SOURCES  3
 
 
-// Actual size (number of calendar entries) of the calendar
+// Configures source `src` (0..CAL_SOURCES-1): its `url` (0 or "" for unused) and `tag`, a short prefix for its labels.
+// Both strings are not copied, they must stay valid. Takes effect at the next cal_restore() or cal_load_begin().
+void   cal_source_set(int src, const char * url, const char * tag);
+
+
+// Actual size (number of calendar entries) of the calendar (all sources)
 int    cal_size();
 
 
-// For calendar entry `ix`, 0<ix<cal_size(), the label, year, month, day
-String cal_label(int ix);
+// For calendar entry `ix`, 0<ix<cal_size(), the label, year, month, day, and the tag of its source ("" if none).
+// The returned label points into the calendar store; it is valid until the next cal_load().
+const char * cal_label(int ix);
+const char * cal_tag(int ix);
 int    cal_year(int ix);
 int    cal_month(int ix);
 int    cal_day(int ix);
@@ -26,13 +35,27 @@ int    cal_daynum(int month, int day );
 int    cal_findfirst(int month, int day);
 
 
-// Load the calendar from the `url`.
-// URL shall point to a CSV file of the form
+// Iterates the entries with a birthday in the `days` days starting today (`year`, `month`, `day`), nearest first.
+// Call cal_window_begin() once, then cal_window_next() until it returns -1. Time taken is proportional to the number of
+// entries returned (not to cal_size()). In a non-leap year, birthdays on 29 Feb are celebrated on 1 Mar.
+void   cal_window_begin(int year, int month, int day, int days);
+// Returns the index of the next entry in the window (or -1 when done), with the days until its birthday (0 is today)
+// and the age on that birthday (either pointer may be 0).
+int    cal_window_next(int * daysuntil, int * age);
+
+
+// Load the calendar from the urls of all sources (see cal_source_set), one after the other.
+// Each URL shall point to a CSV file of the form
 //   mr,1978-10-17\r\n
 //   annie,2002-07-02\r\n
 //   boris,1999-02-04
+// The file is parsed while it is downloaded, so RAM use does not depend on its size (labels are truncated to 31 chars).
+// The server is asked (with the ETag/Last-Modified of the previous load) to only send the file when it was modified.
+// If not, the entries of that source are kept. After a successful load the entries are also saved to a cache file (per source).
+// The sorted entries of the sources are merged (entries with the same date are in source order).
 // If 0 is returned, load was successful, and the data is available via cal_size(),cal_label(),cal_year(),cal_month,cal_day().
-// Otherwise there was an error:
+// Otherwise the error of the first failing source is returned. Its entries are kept, or restored from its cache;
+// the other sources are loaded and merged anyhow. The errors:
 // - Negative values close to 0 are load errors
 //     HTTPC_ERROR_CONNECTION_FAILED   (-1)
 //     HTTPC_ERROR_SEND_HEADER_FAILED  (-2)
@@ -47,7 +70,9 @@ int    cal_findfirst(int month, int day);
 //     HTTPC_ERROR_READ_TIMEOUT        (-11)
 //     CAL_ERROR_UNEXPECTED            (-50)
 //     CAL_ERROR_BEGIN                 (-51)
-//     CAL_EMPTY                       (-52)
+//     CAL_ERROR_BEGIN_REDIRECT        (-52)
+//     CAL_EMPTY                       (-53)
+//     CAL_ERROR_CACHE                 (-54)
 // - Negative values of three digits are http errors (with a minus sign) - print with https.errorToString(code)
 //     Informational responses         (-100 .. -199)
 //     Successful responses            (-200 .. -299)
@@ -64,13 +89,30 @@ int    cal_findfirst(int month, int day);
 //     year out of range               (6)
 //     month out of range              (7)
 //     day out of range                (8)
-//     out of space (SIZE param)       (9)
-int cal_load(const char * url);
-
+//     out of space (SIZE_MAX or heap) (9)
+int cal_load();
+
+// Non-blocking variant of cal_load(): cal_load_begin() starts the load, then call cal_load_step(), e.g. once per loop(),
+// until it returns something else than CAL_BUSY: that is the result, with the same codes as cal_load().
+// Each step does a bounded amount of work (one DNS/connect/header/body-chunk/sort step), so the caller's display keeps
+// running; only the connect step blocks (for https, including the TLS handshake). Calling cal_load_begin() again aborts
+// a busy load. While busy, the previous calendar stays available, except from the body steps of a source until the merge.
+void cal_load_begin();
+int  cal_load_step();
+// Number of bytes of the file received so far (progress indication while busy).
+int  cal_load_received();
+
+#define CAL_BUSY                       (1)
 #define CAL_ERROR_UNEXPECTED           (-50)
 #define CAL_ERROR_BEGIN                (-51)
 #define CAL_ERROR_BEGIN_REDIRECT       (-52)
 #define CAL_EMPTY                      (-53)
+#define CAL_ERROR_CACHE                (-54)
+
+
+// Loads the calendar from the cache files, saved by the last successful cal_load() of each source (for its current url).
+// Gives access to the calendar at boot, before WiFi is up. Returns 0 if at least one source was restored, otherwise CAL_ERROR_CACHE.
+int cal_restore();
 
 
 void cal_init();
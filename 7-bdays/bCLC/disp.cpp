@@ -2,120 +2,11 @@
 
 
 #include <Arduino.h>
-#include <Wire.h>
+#include "tm1650.h"
+#include "font7.h"
 #include "disp.h"
 
 
-// A font, optimized for readability, for a 7 segment display (tewaked from SSoS).
-// Support characters 0..127 (but first 32 are empty).
-static const uint8_t disp_font[0x80] = {
-  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, // padding for 0x0_
-  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, // padding for 0x1_
-  //pgfedcba
-  0b00000000, // 20 spc
-  0b00101000, // 21 !
-  0b00100010, // 22 "
-  0b01100011, // 23 #
-  0b01001001, // 24 $
-  0b00100100, // 25 %
-  0b01111110, // 26 &
-  0b00000010, // 27 '
-  0b00111001, // 28 (
-  0b00001111, // 29 )
-  0b00000001, // 2A *
-  0b01000010, // 2B +
-  0b00001100, // 2C ,
-  0b01000000, // 2D -
-  0b00010000, // 2E .
-  0b01010010, // 2F /
-  //pgfedcba
-  0b00111111, // 30 0
-  0b00000110, // 31 1
-  0b01011011, // 32 2
-  0b01001111, // 33 3
-  0b01100110, // 34 4
-  0b01101101, // 35 5
-  0b01111101, // 36 6
-  0b00000111, // 37 7
-  0b01111111, // 38 8
-  0b01101111, // 39 9
-  0b00001001, // 3A :
-  0b00001010, // 3B ;
-  0b01011000, // 3C <
-  0b01001000, // 3D =
-  0b01001100, // 3E >
-  0b01001011, // 3F ?
-  //pgfedcba
-  0b00111011, // 40 @
-  0b01110111, // 41 A
-  0b01111100, // 42 B
-  0b00111001, // 43 C
-  0b01011110, // 44 D
-  0b01111001, // 45 E
-  0b01110001, // 46 F
-  0b00111101, // 47 G
-  0b01110110, // 48 H
-  0b00110000, // 49 I
-  0b00011110, // 4A J
-  0b01110101, // 4B K
-  0b00111000, // 4C L 
-  0b01010101, // 4D M
-  0b00110111, // 4E N
-  0b00111111, // 4F O
-  //pgfedcba
-  0b01110011, // 50 P
-  0b01101011, // 51 Q
-  0b00110011, // 52 R
-  0b01101101, // 53 S
-  0b01111000, // 54 T
-  0b00111110, // 55 U
-  0b01110010, // 56 V
-  0b01101010, // 57 W
-  0b00110110, // 58 X
-  0b01101110, // 59 Y
-  0b01011011, // 5A Z
-  0b00111001, // 5B [
-  0b01100100, // 5C \ (\ shall not end line in C)
-  0b00001111, // 5D ]
-  0b00100011, // 5E ^
-  0b00001000, // 5F _
-  //pgfedcba
-  0b00100000, // 60 `
-  0b01011111, // 61 a
-  0b01111100, // 62 b
-  0b01011000, // 63 c
-  0b01011110, // 64 d
-  0b01111001, // 65 e
-  0b01110001, // 66 f
-  0b01101111, // 67 g
-  0b01110100, // 68 h
-  0b00110000, // 69 i
-  0b00001101, // 6A j
-  0b01110101, // 6B k
-  0b00111000, // 6C l
-  0b01010101, // 6D m
-  0b01010100, // 6E n
-  0b01011100, // 6F o
-  //pgfedcba
-  0b01110011, // 70 p
-  0b01100111, // 71 q
-  0b01010000, // 72 r
-  0b01101101, // 73 s
-  0b01111000, // 74 t
-  0b00011100, // 75 u
-  0b01110010, // 76 v
-  0b01101010, // 77 w
-  0b00010100, // 78 x
-  0b00101110, // 79 y
-  0b01011011, // 7A z
-  0b01000110, // 7B {
-  0b00000110, // 7C |
-  0b01110000, // 7D }
-  0b01000001, // 7E ~
-  0b01011101  // 7F del
-};
-
-
 // The 303WIFILC01 board does not connect pin X of the TM1650 to pin X of the 4x7 segment display.
 // The DIG1, DIG2, DIG3, and DIG4 or 1-1, so are segments C, D, E, but the other segments are mixed.
 //   to light segment power pin
@@ -128,30 +19,14 @@ static const uint8_t disp_font[0x80] = {
 //           F            G   
 //           G            B   
 //           P            A   
-// The below table performs the remapping of segments.
-static const uint8_t disp_segremap[] = {
-  0x00,0x20,0x80,0xa0,0x04,0x24,0x84,0xa4,0x08,0x28,0x88,0xa8,0x0c,0x2c,0x8c,0xac,
-  0x10,0x30,0x90,0xb0,0x14,0x34,0x94,0xb4,0x18,0x38,0x98,0xb8,0x1c,0x3c,0x9c,0xbc,
-  0x40,0x60,0xc0,0xe0,0x44,0x64,0xc4,0xe4,0x48,0x68,0xc8,0xe8,0x4c,0x6c,0xcc,0xec,
-  0x50,0x70,0xd0,0xf0,0x54,0x74,0xd4,0xf4,0x58,0x78,0xd8,0xf8,0x5c,0x7c,0xdc,0xfc,
-  0x02,0x22,0x82,0xa2,0x06,0x26,0x86,0xa6,0x0a,0x2a,0x8a,0xaa,0x0e,0x2e,0x8e,0xae,
-  0x12,0x32,0x92,0xb2,0x16,0x36,0x96,0xb6,0x1a,0x3a,0x9a,0xba,0x1e,0x3e,0x9e,0xbe,
-  0x42,0x62,0xc2,0xe2,0x46,0x66,0xc6,0xe6,0x4a,0x6a,0xca,0xea,0x4e,0x6e,0xce,0xee,
-  0x52,0x72,0xd2,0xf2,0x56,0x76,0xd6,0xf6,0x5a,0x7a,0xda,0xfa,0x5e,0x7e,0xde,0xfe,
-  0x01,0x21,0x81,0xa1,0x05,0x25,0x85,0xa5,0x09,0x29,0x89,0xa9,0x0d,0x2d,0x8d,0xad,
-  0x11,0x31,0x91,0xb1,0x15,0x35,0x95,0xb5,0x19,0x39,0x99,0xb9,0x1d,0x3d,0x9d,0xbd,
-  0x41,0x61,0xc1,0xe1,0x45,0x65,0xc5,0xe5,0x49,0x69,0xc9,0xe9,0x4d,0x6d,0xcd,0xed,
-  0x51,0x71,0xd1,0xf1,0x55,0x75,0xd5,0xf5,0x59,0x79,0xd9,0xf9,0x5d,0x7d,0xdd,0xfd,
-  0x03,0x23,0x83,0xa3,0x07,0x27,0x87,0xa7,0x0b,0x2b,0x8b,0xab,0x0f,0x2f,0x8f,0xaf,
-  0x13,0x33,0x93,0xb3,0x17,0x37,0x97,0xb7,0x1b,0x3b,0x9b,0xbb,0x1f,0x3f,0x9f,0xbf,
-  0x43,0x63,0xc3,0xe3,0x47,0x67,0xc7,0xe7,0x4b,0x6b,0xcb,0xeb,0x4f,0x6f,0xcf,0xef,
-  0x53,0x73,0xd3,0xf3,0x57,0x77,0xd7,0xf7,0x5b,0x7b,0xdb,0xfb,0x5f,0x7f,0xdf,0xff
-};
-
-
-// The I2C connections on the 303WIFILC01 board
-#define SCL_PIN 12
-#define SDA_PIN 13
+// The font is remapped (at compile time) for this wiring; the table is in flash.
+typedef Font7Wiring<DISP_SEG_A,DISP_SEG_B,DISP_SEG_C,DISP_SEG_D,DISP_SEG_E,DISP_SEG_F,DISP_SEG_G,DISP_SEG_P> disp_wiring_t;
+static constexpr Font7<disp_wiring_t> disp_font PROGMEM = Font7<disp_wiring_t>();
+static_assert( disp_font.segs['8']==0xFE && disp_font.dot==0x01, "font remapping is not done at compile time");
+
+
+// Clock of the TM1650 bus (tm1650.cpp drives GPIO12/13 of the 303WIFILC01 board)
+#define DISP_CLOCK_HZ 400000
 
 
 static uint8_t disp_brightness = 8; // 1 (min) to 8 (max)
@@ -159,13 +34,29 @@ static uint8_t disp_mode7 = 0;      // 0 (8 segments) or 1 (7 segments)
 static uint8_t disp_power = 1;      // 0 (off) or 1 (on)
 
 
-// Writes the current control values (disp_brightness, disp_mode7, disp_power) to the TM1650
+// Shadow of the TM1650 registers, so that only changed registers are sent over I2C
+static uint8_t  disp_frame[4];        // Segments of the digits, as they should be on the display
+static uint8_t  disp_dirty = 0x0F;    // Bit i set: disp_frame[i] not yet sent (changed, or its transfer failed)
+static int      disp_control = -1;    // Control byte last sent, -1 if unknown
+static uint32_t disp_frames;          // Number of frames requested (disp_show/disp_show_raw calls)
+static uint32_t disp_writes;          // Number of registers actually sent
+
+
+// Writes `val` to TM1650 register `reg`. Returns 0 for ok.
+static int disp_write(uint8_t reg, uint8_t val) {
+  disp_writes++;
+  return tm1650_write(reg,val);
+}
+
+
+// Writes the current control values (disp_brightness, disp_mode7, disp_power) to the TM1650, when changed or `force`d
 // Returns I2C transaction code (0 is ok).
-static int disp_updatecontrol() {
+static int disp_updatecontrol(bool force=false) {
   int val = ((disp_brightness%8) << 4) | (disp_mode7<<3) | (disp_power<<0); 
-  Wire.beginTransmission(0x24); // register 0x48 DIG1CTRL
-  Wire.write(val); 
-  return Wire.endTransmission();
+  if( !force && val==disp_control ) return 0;
+  int result = disp_write(TM1650_CONTROL, val);
+  disp_control = result==0 ? val : -1;
+  return result;
 }
 
 
@@ -201,28 +92,60 @@ int disp_power_get() {
 
 // Initializes display (prints error to Serial)
 void disp_init() {
-  Wire.begin(SDA_PIN,SCL_PIN);
+  tm1650_init(DISP_CLOCK_HZ);
   disp_brightness = 8; // max brightness
   disp_mode7 = 0;      // 8 segments
   disp_power = 0;      // off
-  int result = disp_updatecontrol();
+  int result = disp_updatecontrol(true);
   if( result==0 ) Serial.printf("disp: init\n");
   else Serial.printf("disp: init ERROR %d\n",result);
 }
 
 
-// Puts (first 4 chars of) `s` (padded with spaces) on display, using flags in `dots` for P
-void disp_show(const char * s, uint8_t dots) {
+// Lays out `s` on digits: TM1650 segment bytes in `segs`, at most `cap`. A '.', ',' or ':' is folded into the
+// point of the preceding digit (when that has no point yet), so it does not take a digit of its own.
+// Returns the number of digits used.
+int disp_layout(const char * s, uint8_t * segs, int cap) {
+  int  len = 0;
+  bool fold = false; // segs[len-1] can take a point
+  for( ; *s; s++ ) {
+    if( fold && (*s=='.' || *s==',' || *s==':') ) { segs[len-1] |= disp_font.dot; fold = false; continue; }
+    if( len==cap ) break;
+    // Lookup for char *s which segments to enable (already remapped for the wiring). *s is truncated to 7 bits, bit 8 is for P
+    segs[len] = disp_font.get(*s) | ( *s & 0x80 ? disp_font.dot : 0 );
+    fold = !(*s & 0x80);
+    len++;
+  }
+  return len;
+}
+
+
+// Puts the 4 TM1650 segment bytes `segs` (see disp_layout) on display, using flags in `dots` for P
+void disp_show_raw(const uint8_t * segs, uint8_t dots) {
   for(int i=0; i<4; i++ ) {
-    // Lookup for char *s which segments to enable. *s is truncated to 7 bits, bit 8 is for P
-    uint8_t segments1 = (disp_font[*s & 0x7F]) | ( *s & 0x80 );
-    if( dots & (1<<i) ) segments1 |= 0x80; // Add dot to segments
-    // TM1650 is not wired 1-1 to display, so remap segments
-    uint8_t segments2= disp_segremap[segments1];
-    // Send to display
-    Wire.beginTransmission(0x34+i);
-    Wire.write(segments2);
-    Wire.endTransmission();
-    if( *s ) s++; // next char unless at end  
+    uint8_t segments = segs[i];
+    if( dots & (1<<i) ) segments |= disp_font.dot; // Add dot to segments
+    if( disp_frame[i]!=segments ) { disp_frame[i] = segments; disp_dirty |= 1<<i; }
   }
+  disp_frames++;
+  // Send the changed digits to display (a failed one stays dirty, and is retried next frame)
+  for(int i=0; disp_dirty && i<4; i++ ) {
+    if( (disp_dirty & (1<<i)) && disp_write(TM1650_DIGIT1+2*i,disp_frame[i])==0 ) disp_dirty &= ~(1<<i);
+  }
+}
+
+
+// Gets the number of frames requested, and the number of registers actually sent
+void disp_stats(uint32_t * frames, uint32_t * writes) {
+  if( frames ) *frames = disp_frames;
+  if( writes ) *writes = disp_writes;
+}
+
+
+// Puts (first 4 digits of) `s` (padded with spaces) on display, using flags in `dots` for P
+void disp_show(const char * s, uint8_t dots) {
+  uint8_t segs[4];
+  int len = disp_layout(s,segs,4);
+  memset(&segs[len], 0, 4-len);
+  disp_show_raw(segs,dots);
 }
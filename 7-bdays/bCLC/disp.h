@@ -10,12 +10,28 @@
 #define DISP_DOT4      8
 #define DISP_ALL       ( DISP_DOT1 | DISP_DOTCOLON | DISP_DOT3 | DISP_DOT4 )
 
+// Segment bits in the bytes of disp_layout() and disp_show_raw() (the TM1650 is not wired 1-1 to the display)
+#define DISP_SEG_A     0x20
+#define DISP_SEG_B     0x80
+#define DISP_SEG_C     0x04
+#define DISP_SEG_D     0x08
+#define DISP_SEG_E     0x10
+#define DISP_SEG_F     0x40
+#define DISP_SEG_G     0x02
+#define DISP_SEG_P     0x01
+
 void disp_brightness_set(int brightness);       // Sets brightness level 1..8
 int  disp_brightness_get();                     // Gets brightness level
 void disp_power_set(int power);                 // Sets power 0 (off) or 1 (on)
 int  disp_power_get();                          // Gets power level
                                               
 void disp_init();                               // Initializes display (prints error to Serial)
-void disp_show(const char * s, uint8_t dots=0); // Puts (first 4 chars of) `s` (padded with spaces) on display, using flags in `dots` for P
+void disp_show(const char * s, uint8_t dots=0); // Puts (first 4 digits of) `s` (padded with spaces) on display, using flags in `dots` for P
+
+int  disp_layout(const char * s, uint8_t * segs, int cap); // Lays out `s` to (at most `cap`) segment bytes `segs`; returns number used
+                                                            // A '.', ',' or ':' is folded into the point of the preceding digit
+void disp_show_raw(const uint8_t * segs, uint8_t dots=0);   // Puts 4 segment bytes (from disp_layout) on display, using flags in `dots` for P
+                                                            // Only digits that changed are sent over I2C (as is the control byte)
+void disp_stats(uint32_t * frames, uint32_t * writes);      // Gets number of frames requested, and number of registers actually sent
 
 #endif
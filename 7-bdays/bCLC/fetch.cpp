@@ -0,0 +1,513 @@
+// fetch.cpp - resumable HTTP(S) GET that does a bounded amount of work per call
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+#include <ESP8266HTTPClient.h> // HTTPC_ERROR_XXX and HTTP_CODE_XXX
+#include <WiFiClientSecureBearSSL.h>
+#include <lwip/dns.h>
+#include "fetch.h"
+
+
+#define FETCH_BUDGET        256   // Max number of received bytes processed per fetch_step()
+#define FETCH_CHUNK_SIZE    128   // Max number of body bytes written to the sink in one go
+#define FETCH_LINE_SIZE     512   // Longer status/header lines are truncated (google's redirect location is some 300 chars)
+#define FETCH_TIMEOUT_MS    10000 // Max time without progress
+#define FETCH_REDIRECTS_MAX 3
+#define FETCH_KEYS_MAX      4     // Max number of response headers collected for the caller
+#define FETCH_SESSIONS      2     // Number of hosts with a cached TLS session (google redirects docs.google.com to a googleusercontent.com host)
+#define FETCH_DNS_SIZE      4     // Number of hosts with a cached address
+#define FETCH_DNS_TTL_MS    (15*60*1000UL) // Time a cached address is used (lwIP does not pass the record's TTL to us)
+#define FETCH_TLS_MFLN      1024  // TLS buffer sizes (rx and tx) when the server supports Maximum Fragment Length Negotiation
+#define FETCH_TLS_RX        16384 // TLS buffer sizes otherwise (a full TLS record must fit in rx)
+#define FETCH_TLS_TX        512
+
+
+typedef enum fetch_state_e {
+  FETCH_S_IDLE,      // No fetch busy
+  FETCH_S_RESOLVE,   // Waiting for DNS
+  FETCH_S_PROBE,     // Host resolved, next step probes (once per host) whether the server supports MFLN
+  FETCH_S_CONNECT,   // Host resolved, next step connects (and does the TLS handshake)
+  FETCH_S_SEND,      // Connected, next step sends the request
+  FETCH_S_STATUS,    // Receiving the status line
+  FETCH_S_HEADER,    // Receiving header lines
+  FETCH_S_BODY,      // Receiving the body (not chunked)
+  FETCH_S_CHUNKSIZE, // Receiving the size line of a chunk
+  FETCH_S_CHUNKDATA, // Receiving the data of a chunk
+  FETCH_S_CHUNKEND,  // Receiving the empty line after chunk data
+  FETCH_S_TRAILER,   // Receiving trailer lines (after the last chunk)
+  FETCH_S_DRAIN,     // Skipping the body of a redirect, to reuse the connection
+} fetch_state_t;
+
+
+static fetch_state_t fetch_state;
+static WiFiClient *  fetch_client;    // One of the two below, when connected
+
+// The clients are allocated once, not per fetch: a BearSSL client allocates a 6k stack (shared by all BearSSL clients)
+// on construction and frees it on destruction; a static client keeps it, so that it doesn't fragment the heap.
+static BearSSL::WiFiClientSecure fetch_tls;
+static WiFiClient    fetch_tcp;
+static uint32_t      fetch_ms;        // Time of last progress (for time-out)
+static int           fetch_budget;    // Number of bytes that may still be processed in this step
+
+// The request
+static String        fetch_url;       // Changes on a redirect
+static String        fetch_host;
+static uint16_t      fetch_port;
+static String        fetch_path;
+static bool          fetch_secure;    // https
+static String        fetch_extra;
+static int           fetch_redirects;
+
+// The response
+static const char * const * fetch_keys;
+static int           fetch_keycount;
+static String        fetch_vals[FETCH_KEYS_MAX];
+static String        fetch_location;
+static int           fetch_code;
+static int           fetch_length;    // Content-Length, or -1 when unknown
+static bool          fetch_chunked;
+static bool          fetch_close;     // Server closes the connection after the response
+static long          fetch_remaining; // Bytes left in body or chunk, -1 for "till connection closes"
+static int           fetch_count;     // Body bytes written to sink
+
+// Line reader
+static char          fetch_line[FETCH_LINE_SIZE];
+static int           fetch_linelen;
+static bool          fetch_linelong;  // Current line was truncated
+
+// Asynchronous DNS (the callback comes from the lwIP context)
+static volatile int  fetch_dns_result;// 0 pending, 1 resolved, -1 failed
+static ip_addr_t     fetch_dns_addr;
+static uint32_t      fetch_dns_gen;   // Identifies the lookup, callbacks for an aborted lookup are ignored
+static bool          fetch_dns_cached;// The address came from fetch_dns
+static bool          fetch_dns_lwip;  // lwIP answered without a lookup (from its cache)
+
+// Cached addresses, so that a reload skips the DNS round trip
+typedef struct fetch_dns_s {
+  String             host;
+  ip_addr_t          addr;
+  uint32_t           ms;              // Time of the lookup
+} fetch_dns_t;
+static fetch_dns_t   fetch_dns[FETCH_DNS_SIZE];
+
+// Cached TLS sessions (kept across fetches), so that a reconnect does an abbreviated handshake
+typedef struct fetch_session_s {
+  String             host;
+  BearSSL::Session   session;
+  bool               known;           // `session` holds the session of an earlier connect
+  int8_t             mfln;            // Server supports MFLN (1), does not (-1), not yet probed (0)
+  uint32_t           ms;              // Time of last use
+} fetch_session_t;
+static fetch_session_t fetch_sessions[FETCH_SESSIONS];
+static int           fetch_slot;      // The fetch_sessions slot of fetch_host (https only)
+
+// Heap at start of the fetch
+static uint32_t      fetch_heap_free;
+static uint32_t      fetch_heap_block;
+
+// Timing of the request (of one hop in case of redirects)
+static uint32_t      fetch_t_start;   // Request started
+static uint32_t      fetch_t_dns;     // Host resolved
+static uint32_t      fetch_t_conn;    // Connected (TLS handshake done)
+static uint32_t      fetch_t_head;    // Headers in
+static bool          fetch_t_resumed; // The TLS handshake resumed the cached session
+static bool          fetch_t_reused;  // The connection of the previous hop was reused
+
+
+// Splits `url` in host, port and path; returns false if not supported
+static bool fetch_parse(const String & url) {
+  int ix;
+  if( url.startsWith("https://") ) { fetch_secure = true; fetch_port = 443; ix = 8; }
+  else if( url.startsWith("http://") ) { fetch_secure = false; fetch_port = 80; ix = 7; }
+  else return false;
+  int slash = url.indexOf('/',ix);
+  if( slash<0 ) slash = url.length();
+  fetch_host = url.substring(ix,slash);
+  fetch_path = slash<(int)url.length() ? url.substring(slash) : String("/");
+  int colon = fetch_host.indexOf(':');
+  if( colon>=0 ) {
+    fetch_port = fetch_host.substring(colon+1).toInt();
+    fetch_host = fetch_host.substring(0,colon);
+  }
+  return fetch_host.length()>0 && fetch_port>0;
+}
+
+
+static void fetch_dns_found(const char * name, const ip_addr_t * addr, void * arg) {
+  (void)name;
+  if( (uint32_t)(uintptr_t)arg!=fetch_dns_gen ) return; // lookup of an aborted fetch
+  if( addr ) { fetch_dns_addr = *addr; fetch_dns_result = 1; } else fetch_dns_result = -1;
+}
+
+
+// Returns the cached address of `host`, or 0 if not cached or expired
+static const ip_addr_t * fetch_dns_find(const String & host) {
+  for( int i=0; i<FETCH_DNS_SIZE; i++ )
+    if( fetch_dns[i].host==host.c_str() && millis()-fetch_dns[i].ms<FETCH_DNS_TTL_MS ) return &fetch_dns[i].addr;
+  return 0;
+}
+
+
+// Caches `addr` for `host` (replaces the entry for host, or the oldest)
+static void fetch_dns_add(const String & host, const ip_addr_t * addr) {
+  int ix = 0;
+  for( int i=0; i<FETCH_DNS_SIZE; i++ ) {
+    if( fetch_dns[i].host==host.c_str() ) { ix = i; break; }
+    if( fetch_dns[ix].host!="" && (fetch_dns[i].host=="" || millis()-fetch_dns[i].ms > millis()-fetch_dns[ix].ms) ) ix = i;
+  }
+  fetch_dns[ix].host = host;
+  fetch_dns[ix].addr = *addr;
+  fetch_dns[ix].ms = millis();
+}
+
+
+// Returns the TLS session slot for `host` (a fresh slot, the least recently used, if host has none)
+static int fetch_session(const String & host) {
+  int ix = 0;
+  for( int i=0; i<FETCH_SESSIONS; i++ ) {
+    if( fetch_sessions[i].host==host.c_str() ) { fetch_sessions[i].ms = millis(); return i; }
+    if( fetch_sessions[ix].host!="" && (fetch_sessions[i].host=="" || millis()-fetch_sessions[i].ms > millis()-fetch_sessions[ix].ms) ) ix = i;
+  }
+  fetch_sessions[ix].host = host;
+  fetch_sessions[ix].session = BearSSL::Session();
+  fetch_sessions[ix].known = false;
+  fetch_sessions[ix].mfln = 0;
+  fetch_sessions[ix].ms = millis();
+  return ix;
+}
+
+
+// Probes (once per host) if the server supports MFLN, so that the TLS buffers can be small
+static void fetch_probe() {
+  fetch_session_t * slot = &fetch_sessions[fetch_slot];
+  if( slot->mfln!=0 ) return;
+  slot->mfln = BearSSL::WiFiClientSecure::probeMaxFragmentLength(IPAddress(&fetch_dns_addr), fetch_port, FETCH_TLS_MFLN) ? 1 : -1;
+  Serial.printf("ftch: %s %s MFLN %d\n", fetch_host.c_str(), slot->mfln>0 ? "supports" : "does not support", FETCH_TLS_MFLN);
+}
+
+
+// Logs the timing of the request (hop) that just ended
+static void fetch_timing(const char * result) {
+  uint32_t now = millis();
+  Serial.printf("ftch: %s %s: dns %lu ms%s, connect %lu ms%s, headers %lu ms, body %lu ms, %d bytes\n", fetch_host.c_str(), result,
+    (unsigned long)(fetch_t_dns-fetch_t_start), fetch_dns_cached?" (cached)":fetch_dns_lwip?" (lwIP cache)":"",
+    (unsigned long)(fetch_t_conn-fetch_t_dns), fetch_t_reused?" (reused)":fetch_t_resumed?" (resumed session)":fetch_secure?" (new session)":"",
+    fetch_t_head ? (unsigned long)(fetch_t_head-fetch_t_conn) : 0UL, fetch_t_head ? (unsigned long)(now-fetch_t_head) : 0UL, fetch_count);
+}
+
+
+// Prepares for a response on the (new or reused) connection
+static void fetch_response() {
+  fetch_code = 0;
+  fetch_length = -1;
+  fetch_chunked = false;
+  fetch_close = false;
+  fetch_location = "";
+  for( int i=0; i<fetch_keycount; i++ ) fetch_vals[i] = "";
+  fetch_linelen = 0;
+  fetch_linelong = false;
+  fetch_count = 0;
+  fetch_t_head = 0;
+}
+
+
+// Starts the request for fetch_url (also used for redirects): resolve first
+static void fetch_request() {
+  fetch_response();
+  fetch_ms = millis();
+  fetch_t_start = fetch_ms;
+  fetch_t_resumed = false;
+  fetch_t_reused = false;
+  fetch_state = FETCH_S_RESOLVE;
+  fetch_dns_gen++;
+  fetch_dns_result = 0;
+  // The TLS client connects by name (it needs the name for SNI), and the core resolves that name through lwIP.
+  // So for https the name is resolved through lwIP here, and the connect finds it in lwIP's cache; fetch_dns is for http.
+  const ip_addr_t * addr = fetch_secure ? 0 : fetch_dns_find(fetch_host);
+  fetch_dns_cached = addr!=0;
+  fetch_dns_lwip = false;
+  if( addr ) { fetch_dns_addr = *addr; fetch_dns_result = 1; return; }
+  // lwIP answers from its cache (or for an ip address) immediately, otherwise it calls back
+  err_t err = dns_gethostbyname(fetch_host.c_str(), &fetch_dns_addr, fetch_dns_found, (void *)(uintptr_t)fetch_dns_gen);
+  if( err==ERR_OK ) { fetch_dns_result = 1; fetch_dns_lwip = true; }
+  else if( err!=ERR_INPROGRESS ) fetch_dns_result = -1;
+}
+
+
+// Connects to the resolved host
+static int fetch_connect() {
+  if( fetch_secure ) {
+    fetch_session_t * slot = &fetch_sessions[fetch_slot];
+    fetch_tls.setInsecure(); // happy to ignore the SSL certificate
+    fetch_tls.setSession(&slot->session); // BearSSL resumes the session if the server still knows it, and updates it after the handshake
+    if( slot->mfln>0 ) fetch_tls.setBufferSizes(FETCH_TLS_MFLN,FETCH_TLS_MFLN); else fetch_tls.setBufferSizes(FETCH_TLS_RX,FETCH_TLS_TX);
+    BearSSL::Session offered = slot->session; // A resumed handshake keeps the session (id, master secret), a full one replaces it
+    fetch_client = &fetch_tls;
+    // By name, for SNI; the resolve step just resolved it through lwIP, so the lookup is answered from lwIP's cache
+    if( !fetch_tls.connect(fetch_host.c_str(), fetch_port) ) { Serial.printf("ftch: ERROR connect %s\n", fetch_host.c_str()); return HTTPC_ERROR_CONNECTION_FAILED; }
+    fetch_t_resumed = slot->known && memcmp(&offered, &slot->session, sizeof(offered))==0;
+    slot->known = true;
+  } else {
+    fetch_client = &fetch_tcp;
+    if( !fetch_client->connect(IPAddress(&fetch_dns_addr), fetch_port) ) { Serial.printf("ftch: ERROR connect %s\n", fetch_host.c_str()); return HTTPC_ERROR_CONNECTION_FAILED; }
+  }
+  fetch_t_conn = millis();
+  fetch_state = FETCH_S_SEND;
+  return FETCH_BUSY;
+}
+
+
+// Sends the request (on a new or reused connection)
+static int fetch_send() {
+  String host = fetch_host;
+  if( fetch_port!=(fetch_secure?443:80) ) host = host + ":" + fetch_port;
+  String request = "GET " + fetch_path + " HTTP/1.1\r\nHost: " + host + "\r\nUser-Agent: ESP8266\r\nAccept-Encoding: identity\r\n" + fetch_extra + "\r\n";
+  if( fetch_client->write((const uint8_t *)request.c_str(), request.length())!=request.length() ) return HTTPC_ERROR_SEND_HEADER_FAILED;
+  fetch_ms = millis();
+  fetch_state = FETCH_S_STATUS;
+  return FETCH_BUSY;
+}
+
+
+// Reads received bytes into fetch_line (within budget); returns true when a complete line is in (without \r\n)
+static bool fetch_readline() {
+  while( fetch_budget>0 ) {
+    int ch = fetch_client->read();
+    if( ch<0 ) return false;
+    fetch_budget--;
+    fetch_ms = millis();
+    if( ch=='\n' ) {
+      fetch_line[fetch_linelen] = '\0';
+      fetch_linelen = 0;
+      return true;
+    }
+    if( fetch_linelen==0 ) fetch_linelong = false;
+    if( ch=='\r' ) continue;
+    if( fetch_linelen<FETCH_LINE_SIZE-1 ) fetch_line[fetch_linelen++] = ch; else fetch_linelong = true;
+  }
+  return false;
+}
+
+
+// No (more) bytes to process in this step: busy, or `error` when the connection is closed, or timed out
+static int fetch_wait(int error) {
+  if( fetch_client->available()>0 ) return FETCH_BUSY; // budget used up
+  if( !fetch_client->connected() ) return error;
+  if( millis()-fetch_ms > FETCH_TIMEOUT_MS ) return HTTPC_ERROR_READ_TIMEOUT;
+  return FETCH_BUSY;
+}
+
+
+// Records the header in fetch_line, when it is one we need
+static void fetch_header_parse() {
+  char * colon = strchr(fetch_line,':');
+  if( colon==0 ) return;
+  *colon = '\0';
+  const char * val = colon+1;
+  while( *val==' ' ) val++;
+  if( strcasecmp(fetch_line,"content-length")==0 ) fetch_length = atol(val);
+  else if( strcasecmp(fetch_line,"transfer-encoding")==0 ) fetch_chunked = strstr(val,"chunked")!=0;
+  else if( strcasecmp(fetch_line,"location")==0 ) fetch_location = fetch_linelong ? "" : val;
+  else if( strcasecmp(fetch_line,"connection")==0 ) fetch_close = strcasestr(val,"close")!=0;
+  for( int i=0; i<fetch_keycount; i++ )
+    if( strcasecmp(fetch_line,fetch_keys[i])==0 ) fetch_vals[i] = fetch_linelong ? "" : val;
+}
+
+
+// All headers are in: follow a redirect, or prepare for the body
+static int fetch_headers_done() {
+  if( fetch_code>=100 && fetch_code<200 ) { fetch_state = FETCH_S_STATUS; return FETCH_BUSY; } // e.g. 100 Continue, the real status follows
+  bool redirect = fetch_code==HTTP_CODE_MOVED_PERMANENTLY || fetch_code==HTTP_CODE_FOUND || fetch_code==HTTP_CODE_SEE_OTHER
+               || fetch_code==HTTP_CODE_TEMPORARY_REDIRECT || fetch_code==HTTP_CODE_PERMANENT_REDIRECT;
+  if( redirect ) {
+    if( fetch_location=="" || fetch_redirects==FETCH_REDIRECTS_MAX ) return FETCH_ERROR_REDIRECT;
+    fetch_redirects++;
+    fetch_timing("redirect");
+    if( fetch_location.startsWith("/") ) fetch_location = String(fetch_secure?"https://":"http://") + fetch_host + ":" + fetch_port + fetch_location;
+    String host = fetch_host;
+    uint16_t port = fetch_port;
+    bool secure = fetch_secure;
+    fetch_url = fetch_location;
+    if( !fetch_parse(fetch_url) ) return FETCH_ERROR_REDIRECT;
+    Serial.printf("ftch: %d redirect to %s\n", fetch_code, fetch_host.c_str());
+    // Same server, and it keeps the connection open: skip the body of the redirect and send the new request on the same connection
+    if( fetch_host==host.c_str() && fetch_port==port && fetch_secure==secure && !fetch_close && !fetch_chunked && fetch_length>=0 ) {
+      fetch_remaining = fetch_length;
+      fetch_state = FETCH_S_DRAIN;
+      return FETCH_BUSY;
+    }
+    fetch_client->stop();
+    fetch_request();
+    return FETCH_BUSY;
+  }
+  fetch_t_head = millis();
+  if( fetch_code==HTTP_CODE_NO_CONTENT || fetch_code==HTTP_CODE_NOT_MODIFIED ) { fetch_chunked = false; fetch_remaining = 0; }
+  else fetch_remaining = fetch_length;
+  fetch_state = fetch_chunked ? FETCH_S_CHUNKSIZE : FETCH_S_BODY;
+  return FETCH_HEADERS;
+}
+
+
+// Passes received body bytes (at most fetch_remaining, unless that is -1) to sink (0 discards them)
+static int fetch_body(Print * sink) {
+  int avail = fetch_client->available();
+  if( avail<=0 ) {
+    if( fetch_remaining<0 && !fetch_client->connected() ) return FETCH_DONE; // body ends when connection closes
+    return fetch_wait(HTTPC_ERROR_CONNECTION_LOST);
+  }
+  uint8_t buf[FETCH_CHUNK_SIZE];
+  int size = min(min(avail,FETCH_CHUNK_SIZE),fetch_budget);
+  if( fetch_remaining>=0 && fetch_remaining<size ) size = fetch_remaining;
+  size = fetch_client->read(buf,size);
+  if( size<=0 ) return fetch_wait(HTTPC_ERROR_CONNECTION_LOST);
+  fetch_budget -= size;
+  fetch_ms = millis();
+  if( sink && (int)sink->write(buf,size)!=size ) return HTTPC_ERROR_STREAM_WRITE;
+  fetch_count += size;
+  if( fetch_remaining>0 ) fetch_remaining -= size;
+  return FETCH_BUSY;
+}
+
+
+static int fetch_run(Print * sink) {
+  fetch_budget = FETCH_BUDGET;
+  while( 1 ) {
+    int res;
+    switch( fetch_state ) {
+      case FETCH_S_IDLE:
+        return HTTPC_ERROR_NOT_CONNECTED;
+      case FETCH_S_RESOLVE:
+        if( fetch_dns_result==0 ) return millis()-fetch_ms > FETCH_TIMEOUT_MS ? HTTPC_ERROR_CONNECTION_FAILED : FETCH_BUSY;
+        if( fetch_dns_result<0 ) { Serial.printf("ftch: ERROR dns %s\n", fetch_host.c_str()); return HTTPC_ERROR_CONNECTION_FAILED; }
+        if( !fetch_dns_cached ) fetch_dns_add(fetch_host,&fetch_dns_addr);
+        fetch_t_dns = millis();
+        fetch_state = FETCH_S_CONNECT;
+        if( fetch_secure ) { fetch_slot = fetch_session(fetch_host); if( fetch_sessions[fetch_slot].mfln==0 ) fetch_state = FETCH_S_PROBE; }
+        return FETCH_BUSY; // The probe and connect steps take long, give the caller a turn first
+      case FETCH_S_PROBE:
+        fetch_probe();
+        fetch_t_dns = millis(); // exclude the probe from the connect time
+        fetch_state = FETCH_S_CONNECT;
+        return FETCH_BUSY;
+      case FETCH_S_CONNECT:
+        return fetch_connect();
+      case FETCH_S_SEND:
+        return fetch_send();
+      case FETCH_S_STATUS:
+        if( !fetch_readline() ) return fetch_wait(HTTPC_ERROR_CONNECTION_LOST);
+        if( strncmp(fetch_line,"HTTP/1.",7)!=0 || strlen(fetch_line)<12 ) return HTTPC_ERROR_NO_HTTP_SERVER;
+        fetch_code = atoi(fetch_line+9);
+        fetch_state = FETCH_S_HEADER;
+        break;
+      case FETCH_S_HEADER:
+        if( !fetch_readline() ) return fetch_wait(HTTPC_ERROR_CONNECTION_LOST);
+        if( fetch_line[0]!='\0' ) { fetch_header_parse(); break; }
+        return fetch_headers_done();
+      case FETCH_S_BODY:
+        if( fetch_remaining==0 ) return FETCH_DONE;
+        if( fetch_budget==0 ) return FETCH_BUSY;
+        if( sink==0 ) return HTTPC_ERROR_NO_STREAM;
+        res = fetch_body(sink);
+        if( res!=FETCH_BUSY || fetch_budget==0 ) return res;
+        break;
+      case FETCH_S_CHUNKSIZE:
+        if( !fetch_readline() ) return fetch_wait(HTTPC_ERROR_CONNECTION_LOST);
+        if( !isxdigit(fetch_line[0]) ) return HTTPC_ERROR_ENCODING;
+        fetch_remaining = strtol(fetch_line,0,16);
+        fetch_state = fetch_remaining==0 ? FETCH_S_TRAILER : FETCH_S_CHUNKDATA;
+        break;
+      case FETCH_S_CHUNKDATA:
+        if( fetch_remaining==0 ) { fetch_state = FETCH_S_CHUNKEND; break; }
+        if( fetch_budget==0 ) return FETCH_BUSY;
+        if( sink==0 ) return HTTPC_ERROR_NO_STREAM;
+        res = fetch_body(sink);
+        if( res!=FETCH_BUSY || fetch_budget==0 ) return res;
+        break;
+      case FETCH_S_CHUNKEND:
+        if( !fetch_readline() ) return fetch_wait(HTTPC_ERROR_CONNECTION_LOST);
+        if( fetch_line[0]!='\0' ) return HTTPC_ERROR_ENCODING;
+        fetch_state = FETCH_S_CHUNKSIZE;
+        break;
+      case FETCH_S_TRAILER:
+        if( !fetch_readline() ) return fetch_wait(HTTPC_ERROR_CONNECTION_LOST);
+        if( fetch_line[0]=='\0' ) return FETCH_DONE;
+        break;
+      case FETCH_S_DRAIN:
+        if( fetch_remaining==0 ) {
+          fetch_response();
+          fetch_t_start = millis();
+          fetch_t_dns = fetch_t_start;
+          fetch_t_conn = fetch_t_start;
+          fetch_t_reused = true;
+          fetch_state = FETCH_S_SEND;
+          break;
+        }
+        if( fetch_budget==0 ) return FETCH_BUSY;
+        res = fetch_body(0);
+        if( res!=FETCH_BUSY || fetch_budget==0 ) return res;
+        break;
+    }
+  }
+}
+
+
+bool fetch_begin(const char * url, const char * extra, const char * const * keys, int count) {
+  fetch_end();
+  fetch_url = url;
+  if( !fetch_parse(fetch_url) ) { Serial.printf("ftch: ERROR url not supported\n"); return false; }
+  fetch_extra = extra ? extra : "";
+  fetch_keys = keys;
+  fetch_keycount = min(count,FETCH_KEYS_MAX);
+  fetch_redirects = 0;
+  fetch_heap_free = ESP.getFreeHeap();
+  fetch_heap_block = ESP.getMaxFreeBlockSize();
+  Serial.printf("ftch: heap %u free, largest block %u (before)\n", (unsigned)fetch_heap_free, (unsigned)fetch_heap_block);
+  fetch_request();
+  return true;
+}
+
+
+// Closes the connection, and logs the timing (with `result`) if a request was sent
+static void fetch_stop(const char * result) {
+  if( fetch_state==FETCH_S_IDLE ) return;
+  if( fetch_state>=FETCH_S_SEND ) fetch_timing(result);
+  if( fetch_client ) fetch_client->stop(); // frees the TLS buffers
+  fetch_client = 0;
+  fetch_dns_gen++; // ignore a pending lookup
+  fetch_state = FETCH_S_IDLE;
+  Serial.printf("ftch: heap %u free, largest block %u (after, was %u, %u)\n", (unsigned)ESP.getFreeHeap(), (unsigned)ESP.getMaxFreeBlockSize(), (unsigned)fetch_heap_free, (unsigned)fetch_heap_block);
+}
+
+
+int fetch_step(Print * sink) {
+  int res = fetch_run(sink);
+  if( res==FETCH_BUSY || res==FETCH_HEADERS ) return res;
+  if( res<0 ) Serial.printf("ftch: ERROR %d (state %d, status %d)\n", res, fetch_state, fetch_code);
+  fetch_stop(res<0 ? "failed" : "done");
+  return res;
+}
+
+
+void fetch_end() {
+  fetch_stop("ended");
+}
+
+
+int fetch_status() {
+  return fetch_code;
+}
+
+
+int fetch_size() {
+  return fetch_length;
+}
+
+
+const char * fetch_header(int i) {
+  if( i<0 || i>=fetch_keycount ) return "";
+  return fetch_vals[i].c_str();
+}
+
+
+int fetch_received() {
+  return fetch_count;
+}
@@ -0,0 +1,152 @@
+// font7.h - a 7-segment font, remapped at compile time to the display wiring of a board
+#ifndef _FONT7_H_
+#define _FONT7_H_
+
+
+#include <Arduino.h> // PROGMEM, pgm_read_byte
+
+
+// The font has the segments in logical order: bit 0 is segment a, ..., bit 6 is segment g, bit 7 is the point p.
+//    -a-
+//   f   b
+//    -g-
+//   e   c
+//    -d-  p
+// It is optimized for readability (tweaked from SSoS). Supports characters 0..127 (but first 32 are empty).
+// It is only used at compile time, to generate the table for a board (see Font7), so it takes no flash or RAM.
+static constexpr uint8_t font7_logical[0x80] = {
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, // padding for 0x0_
+  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, // padding for 0x1_
+  //pgfedcba
+  0b00000000, // 20 spc
+  0b00101000, // 21 !
+  0b00100010, // 22 "
+  0b01100011, // 23 #
+  0b01001001, // 24 $
+  0b00100100, // 25 %
+  0b01111110, // 26 &
+  0b00000010, // 27 '
+  0b00111001, // 28 (
+  0b00001111, // 29 )
+  0b00000001, // 2A *
+  0b01000010, // 2B +
+  0b00001100, // 2C ,
+  0b01000000, // 2D -
+  0b00010000, // 2E .
+  0b01010010, // 2F /
+  //pgfedcba
+  0b00111111, // 30 0
+  0b00000110, // 31 1
+  0b01011011, // 32 2
+  0b01001111, // 33 3
+  0b01100110, // 34 4
+  0b01101101, // 35 5
+  0b01111101, // 36 6
+  0b00000111, // 37 7
+  0b01111111, // 38 8
+  0b01101111, // 39 9
+  0b00001001, // 3A :
+  0b00001010, // 3B ;
+  0b01011000, // 3C <
+  0b01001000, // 3D =
+  0b01001100, // 3E >
+  0b01001011, // 3F ?
+  //pgfedcba
+  0b00111011, // 40 @
+  0b01110111, // 41 A
+  0b01111100, // 42 B
+  0b00111001, // 43 C
+  0b01011110, // 44 D
+  0b01111001, // 45 E
+  0b01110001, // 46 F
+  0b00111101, // 47 G
+  0b01110110, // 48 H
+  0b00110000, // 49 I
+  0b00011110, // 4A J
+  0b01110101, // 4B K
+  0b00111000, // 4C L 
+  0b01010101, // 4D M
+  0b00110111, // 4E N
+  0b00111111, // 4F O
+  //pgfedcba
+  0b01110011, // 50 P
+  0b01101011, // 51 Q
+  0b00110011, // 52 R
+  0b01101101, // 53 S
+  0b01111000, // 54 T
+  0b00111110, // 55 U
+  0b01110010, // 56 V
+  0b01101010, // 57 W
+  0b00110110, // 58 X
+  0b01101110, // 59 Y
+  0b01011011, // 5A Z
+  0b00111001, // 5B [
+  0b01100100, // 5C \ (\ shall not end line in C)
+  0b00001111, // 5D ]
+  0b00100011, // 5E ^
+  0b00001000, // 5F _
+  //pgfedcba
+  0b00100000, // 60 `
+  0b01011111, // 61 a
+  0b01111100, // 62 b
+  0b01011000, // 63 c
+  0b01011110, // 64 d
+  0b01111001, // 65 e
+  0b01110001, // 66 f
+  0b01101111, // 67 g
+  0b01110100, // 68 h
+  0b00110000, // 69 i
+  0b00001101, // 6A j
+  0b01110101, // 6B k
+  0b00111000, // 6C l
+  0b01010101, // 6D m
+  0b01010100, // 6E n
+  0b01011100, // 6F o
+  //pgfedcba
+  0b01110011, // 70 p
+  0b01100111, // 71 q
+  0b01010000, // 72 r
+  0b01101101, // 73 s
+  0b01111000, // 74 t
+  0b00011100, // 75 u
+  0b01110010, // 76 v
+  0b01101010, // 77 w
+  0b00010100, // 78 x
+  0b00101110, // 79 y
+  0b01011011, // 7A z
+  0b01000110, // 7B {
+  0b00000110, // 7C |
+  0b01110000, // 7D }
+  0b01000001, // 7E ~
+  0b01011101  // 7F del
+};
+
+
+// Describes how a board wires the display to the driver chip: template argument X is the bit (mask)
+// in the driver's segment register that lights segment x of the display.
+template<uint8_t A, uint8_t B, uint8_t C, uint8_t D, uint8_t E, uint8_t F, uint8_t G, uint8_t P>
+struct Font7Wiring {
+  // Maps logical segments (bit 0 is a, ..., bit 7 is p) to the bits of the driver's segment register
+  static constexpr uint8_t remap(uint8_t segs) {
+    return (segs&0x01?A:0) | (segs&0x02?B:0) | (segs&0x04?C:0) | (segs&0x08?D:0)
+         | (segs&0x10?E:0) | (segs&0x20?F:0) | (segs&0x40?G:0) | (segs&0x80?P:0);
+  }
+};
+
+
+// The font for wiring W: font7_logical with each entry remapped, computed by the compiler.
+// Define an instance as `static constexpr Font7<W> name PROGMEM = Font7<W>();` so that the table lives in flash.
+template<class W>
+struct Font7 {
+  uint8_t segs[0x80];
+  constexpr Font7() : segs() {
+    for( int c=0; c<0x80; c++ ) segs[c] = W::remap(font7_logical[c]);
+  }
+  // The segment register value for char `c` (truncated to 7 bits); the table is in flash, so it is read with pgm_read_byte
+  uint8_t get(char c) const { return pgm_read_byte(&segs[c & 0x7F]); }
+  // The segment register value for the point
+  static constexpr uint8_t dot = W::remap(0x80);
+};
+
+
+#endif
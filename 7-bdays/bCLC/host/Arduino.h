@@ -0,0 +1,57 @@
+// Arduino.h - the part of the ESP8266 core used by cal.cpp, banner.cpp and disp.cpp, so that their benches build on a PC (see bench.cpp)
+#ifndef _HOST_ARDUINO_H_
+#define _HOST_ARDUINO_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+
+#define PROGMEM
+inline uint8_t pgm_read_byte(const void * p) { return *(const uint8_t *)p; }
+
+template<class T> T min(T a, T b) { return a<b ? a : b; }
+template<class T> T max(T a, T b) { return a>b ? a : b; }
+
+unsigned long millis();
+unsigned long micros();
+void yield();
+
+// Not every libc has strlcpy
+inline size_t host_strlcpy(char * dst, const char * src, size_t size) {
+  size_t len = strlen(src);
+  if( size>0 ) { size_t n = len<size-1 ? len : size-1; memcpy(dst,src,n); dst[n]='\0'; }
+  return len;
+}
+#define strlcpy host_strlcpy
+
+class String {
+  public:
+    String(const char * s="") : _s(s) {}
+    const char * c_str() const { return _s.c_str(); }
+    friend String operator+(const String & a, const char * b) { String r(a); r._s += b; return r; }
+  private:
+    std::string _s;
+};
+
+class Print {
+  public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t ch) = 0;
+    virtual size_t write(const uint8_t * buf, size_t size) { size_t n=0; while( n<size && write(buf[n]) ) n++; return n; }
+    size_t printf(const char * format, ...) __attribute__((format(printf,2,3))) {
+      va_list args; va_start(args,format); int n=vprintf(format,args); va_end(args); return n;
+    }
+};
+
+class HardwareSerial : public Print {
+  public:
+    size_t write(uint8_t ch) override { return putchar(ch)==EOF ? 0 : 1; }
+};
+extern HardwareSerial Serial;
+
+#endif
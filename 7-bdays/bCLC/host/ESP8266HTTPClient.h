@@ -0,0 +1,5 @@
+// ESP8266HTTPClient.h - the status codes used by cal.cpp and bench.cpp
+#include "Arduino.h"
+
+#define HTTP_CODE_OK           200
+#define HTTP_CODE_NOT_MODIFIED 304
@@ -0,0 +1,2 @@
+// Print.h - see Arduino.h
+#include "Arduino.h"
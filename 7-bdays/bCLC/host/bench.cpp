@@ -0,0 +1,74 @@
+// bench.cpp - runs the calendar bench (CAL_INCLUDE_BENCH) and the banner bench (BANNER_INCLUDE_BENCH) on a PC
+//
+// This folder is not part of the sketch (the Arduino IDE only compiles the sketch folder itself, and src/).
+// Its headers stand in for the ESP8266 core: there is no file system (so no cache), and the fetch serves the
+// sample calendar below instead of downloading. Build and run from the sketch folder with
+//   g++ -O2 -Ihost -I. -DCAL_INCLUDE_BENCH=1 -DBANNER_INCLUDE_BENCH=1 cal.cpp banner.cpp disp.cpp host/bench.cpp -o bench && ./bench
+// Timings are those of the PC; enable the flags in the sketch to measure on the ESP8266.
+
+#include <Arduino.h>
+#include <ESP8266HTTPClient.h>
+#include <LittleFS.h>
+#include <chrono>
+#include "../fetch.h"
+#include "../tm1650.h"
+#include "../cal.h"
+#include "../banner.h"
+
+
+HardwareSerial Serial;
+FS LittleFS;
+
+static const auto bench_t0 = std::chrono::steady_clock::now();
+unsigned long millis() { return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now()-bench_t0).count(); }
+unsigned long micros() { return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now()-bench_t0).count(); }
+void yield() {}
+
+
+// The display is not there
+void     tm1650_init(uint32_t) {}
+uint32_t tm1650_clock() { return 0; }
+int      tm1650_write(uint8_t, uint8_t) { return 0; }
+int      tm1650_frame(const uint8_t *, uint8_t) { return 0; }
+
+
+// The sample calendar: names with dots (folded into the preceding digit by disp_layout) and without
+static const char bench_csv[] =
+  "Dr. Jansen,1961-01-14\r\n"
+  "J.P. de Vries,1975-02-28\r\n"
+  "Anna,1990-03-03\r\n"
+  "Mr. T. Bakker,1958-04-21\r\n"
+  "Bram,2001-05-09\r\n"
+  "Prof. dr. Smit,1949-06-30\r\n"
+  "Chris,1984-07-04\r\n"
+  "A.M. Visser,1969-08-15\r\n"
+  "Daan,2010-09-22\r\n"
+  "Mw. E. de Boer,1972-10-01\r\n"
+  "Eva,1995-11-11\r\n"
+  "St. Nicolaas,1900-12-05\r\n";
+
+// The fetch serves bench_csv for any url: headers in the first step, the body in the second
+static int bench_step;
+bool fetch_begin(const char *, const char *, const char * const *, int) { bench_step = 0; return true; }
+int  fetch_step(Print * sink) {
+  if( bench_step++==0 ) return FETCH_HEADERS;
+  sink->write((const uint8_t *)bench_csv, sizeof(bench_csv)-1);
+  return FETCH_DONE;
+}
+void fetch_end() {}
+int  fetch_status() { return HTTP_CODE_OK; }
+int  fetch_size() { return sizeof(bench_csv)-1; }
+const char * fetch_header(int) { return ""; }
+int  fetch_received() { return bench_step>1 ? sizeof(bench_csv)-1 : 0; }
+
+
+int main() {
+  cal_init(); // runs the cal bench
+  cal_source_set(0, "http://sample/bench.csv", "");
+  int error = cal_load();
+  Serial.printf("cal : loaded %d entries (%d)\n", cal_size(), error);
+  struct tm t = {};
+  t.tm_year = 2024-1900; t.tm_mon = 0; t.tm_mday = 1; t.tm_yday = 0;
+  banner_make(&t, 7, error); // the first banner with a calendar runs the banner bench
+  return 0;
+}
@@ -0,0 +1,11 @@
+// coredecls.h - crc32() as in the ESP8266 core (polynomial 0x04C11DB7, not reflected, no final xor)
+#include "Arduino.h"
+
+inline uint32_t crc32(const void * data, size_t length, uint32_t crc=0xffffffff) {
+  const uint8_t * p = (const uint8_t *)data;
+  while( length-- ) {
+    crc ^= (uint32_t)*p++ << 24;
+    for( int i=0; i<8; i++ ) crc = crc & 0x80000000 ? (crc<<1) ^ 0x04C11DB7 : crc<<1;
+  }
+  return crc;
+}
@@ -0,0 +1,144 @@
+// marquee.cpp - scroll a long text (a strip of segment bytes) over the 4 digit display
+
+#include <Arduino.h>
+#include <Ticker.h>
+#include "disp.h"
+#include "marquee.h"
+
+
+// The phases of playing a strip
+#define MARQUEE_PHASE_IDLE 0 // Not playing
+#define MARQUEE_PHASE_FULL 1 // Showing scroll step `marquee_step`
+#define MARQUEE_PHASE_HALF 2 // Showing the half step between `marquee_step` and the next
+#define MARQUEE_PHASE_WIPE 3 // Wiping the last step away, `marquee_wiped` rows are gone
+
+
+static Ticker                marquee_ticker;
+static const uint8_t *       marquee_strip;
+static int                   marquee_len;
+static const marquee_cfg_t * marquee_cfg;
+static volatile int          marquee_phase;   // MARQUEE_PHASE_IDLE, ...
+static int                   marquee_step;    // 0 .. marquee_last
+static int                   marquee_last;    // Last scroll step
+static int                   marquee_wiped;   // Number of segment rows wiped
+static uint8_t               marquee_own[MARQUEE_SIZE]; // Strip for marquee_text()
+static void               (* marquee_notify_fn)();      // Called after each frame and at the end
+
+// The timer composes the frame, loop() reads it; it is published with a single (atomic) 32 bit store
+static volatile uint32_t     marquee_front;
+static uint8_t               marquee_out[4];
+
+
+// Segment rows for the wipe, top to bottom
+static const uint8_t marquee_rows[] = { DISP_SEG_A, DISP_SEG_B|DISP_SEG_F, DISP_SEG_G, DISP_SEG_C|DISP_SEG_E, DISP_SEG_D|DISP_SEG_P };
+#define MARQUEE_ROWS ( sizeof(marquee_rows)/sizeof(marquee_rows[0]) )
+
+
+// Returns byte `ix` of the strip, blank when outside
+static uint8_t marquee_at(int ix) {
+  return ix<marquee_len ? marquee_strip[ix] : 0;
+}
+
+
+// Composes the frame for the current phase and publishes it
+static void marquee_compose() {
+  uint8_t frame[4];
+  for( int d=0; d<4; d++ ) {
+    uint8_t c0 = marquee_at(marquee_step+d);
+    if( marquee_phase==MARQUEE_PHASE_HALF ) {
+      // Right column of this char moves to the left column, left column of the next char moves to the right column
+      uint8_t c1 = marquee_at(marquee_step+d+1);
+      c0 = (c0&DISP_SEG_B?DISP_SEG_F:0) | (c0&DISP_SEG_C?DISP_SEG_E:0) | (c1&DISP_SEG_F?DISP_SEG_B:0) | (c1&DISP_SEG_E?DISP_SEG_C:0);
+    } else if( marquee_phase==MARQUEE_PHASE_WIPE ) {
+      for( int r=0; r<marquee_wiped; r++ ) c0 &= ~marquee_rows[r];
+    }
+    frame[d] = c0;
+  }
+  uint32_t front;
+  memcpy(&front, frame, 4);
+  marquee_front = front;
+}
+
+
+// Timer callback: advances to the next frame, and schedules the one after that
+static void marquee_next() {
+  uint32_t ms = marquee_cfg->step_ms;
+  switch( marquee_phase ) {
+    case MARQUEE_PHASE_FULL:
+      if( marquee_step<marquee_last && (marquee_cfg->effects & MARQUEE_HALFSTEP) ) {
+        marquee_phase = MARQUEE_PHASE_HALF;
+        ms = ms/2;
+      } else if( marquee_step<marquee_last ) {
+        marquee_step++;
+        if( marquee_step==marquee_last ) ms += marquee_cfg->end_ms;
+      } else if( marquee_cfg->effects & MARQUEE_WIPE ) {
+        marquee_phase = MARQUEE_PHASE_WIPE;
+        marquee_wiped = 1;
+        ms = ms/2;
+      } else {
+        marquee_phase = MARQUEE_PHASE_IDLE;
+      }
+      break;
+    case MARQUEE_PHASE_HALF:
+      marquee_phase = MARQUEE_PHASE_FULL;
+      marquee_step++;
+      ms = ms/2;
+      if( marquee_step==marquee_last ) ms += marquee_cfg->end_ms;
+      break;
+    case MARQUEE_PHASE_WIPE:
+      marquee_wiped++;
+      ms = ms/2;
+      if( marquee_wiped>(int)MARQUEE_ROWS ) marquee_phase = MARQUEE_PHASE_IDLE;
+      break;
+  }
+  if( marquee_phase!=MARQUEE_PHASE_IDLE ) {
+    marquee_compose();
+    marquee_ticker.once_ms(ms, marquee_next);
+  }
+  if( marquee_notify_fn ) marquee_notify_fn();
+}
+
+
+void marquee_play(const uint8_t * strip, int len, const marquee_cfg_t * cfg) {
+  marquee_ticker.detach();
+  marquee_strip = strip;
+  marquee_len = len;
+  marquee_cfg = cfg;
+  marquee_step = 0;
+  marquee_last = max(len-4,0);
+  marquee_phase = MARQUEE_PHASE_FULL;
+  marquee_compose();
+  uint32_t ms = (cfg->effects & MARQUEE_HALFSTEP ? cfg->step_ms/2 : cfg->step_ms) + cfg->start_ms;
+  if( marquee_last==0 ) ms += cfg->end_ms; // first frame is also the last
+  marquee_ticker.once_ms(ms, marquee_next);
+}
+
+
+void marquee_text(const char * text, const marquee_cfg_t * cfg) {
+  marquee_stop(); // marquee_own may be playing
+  int len = disp_layout(text, marquee_own, MARQUEE_SIZE);
+  marquee_play(marquee_own, len, cfg);
+}
+
+
+void marquee_stop() {
+  marquee_ticker.detach();
+  marquee_phase = MARQUEE_PHASE_IDLE;
+}
+
+
+bool marquee_busy() {
+  return marquee_phase!=MARQUEE_PHASE_IDLE;
+}
+
+
+void marquee_notify(void (*fn)()) {
+  marquee_notify_fn = fn;
+}
+
+
+const uint8_t * marquee_frame() {
+  uint32_t front = marquee_front;
+  memcpy(marquee_out, &front, 4);
+  return marquee_out;
+}
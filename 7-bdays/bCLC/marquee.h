@@ -0,0 +1,39 @@
+// marquee.h - interface to scroll a long text (a strip of segment bytes) over the 4 digit display
+#ifndef _MARQUEE_H_
+#define _MARQUEE_H_
+
+#include <stdint.h>
+
+// Effects (flags for marquee_cfg_t.effects)
+#define MARQUEE_HALFSTEP 1 // Between two scroll steps, show a frame with the vertical segments shifted half a digit
+#define MARQUEE_WIPE     2 // At the end, wipe the text away, top row of segments first
+
+typedef struct marquee_cfg_s {
+  uint16_t step_ms;  // Time of one scroll step (the speed)
+  uint16_t start_ms; // Pause: extra time the first frame is shown
+  uint16_t end_ms;   // Pause: extra time the last frame is shown
+  uint8_t  effects;  // MARQUEE_XXX flags
+} marquee_cfg_t;
+
+// Starts scrolling `len` segment bytes of `strip` (e.g. made with disp_layout); the first frame is strip[0..3],
+// the last strip[len-4..len-1]. `strip` and `cfg` are not copied, they must stay valid while the marquee plays.
+// A timer advances the frames, so the speed does not depend on loop(); loop() puts marquee_frame() on the display.
+void marquee_play(const uint8_t * strip, int len, const marquee_cfg_t * cfg);
+
+// Lays out `text` into a strip owned by the marquee (at most MARQUEE_SIZE digits), then plays that.
+#define MARQUEE_SIZE 64
+void marquee_text(const char * text, const marquee_cfg_t * cfg);
+
+// Stops the marquee
+void marquee_stop();
+
+// Returns true while the marquee plays
+bool marquee_busy();
+
+// Returns the current frame: 4 segment bytes for disp_show_raw()
+const uint8_t * marquee_frame();
+
+// Sets `fn` to be called (from the timer) after each new frame and at the end, e.g. to wake the loop; 0 for none
+void marquee_notify(void (*fn)());
+
+#endif
@@ -0,0 +1,111 @@
+// tasks.cpp - a cooperative scheduler: tasks with deadlines, the CPU sleeps in between
+
+#include <Arduino.h>
+#include <coredecls.h> // esp_delay()
+#include "tasks.h"
+
+
+typedef struct tasks_task_s {
+  const char * name;
+  void      (* fn)();
+  uint32_t     period_ms; // 0 for a one-shot
+  uint32_t     due_ms;    // Deadline (millis), when armed
+  bool         armed;
+  uint32_t     runs;      // Statistics since the last report
+  uint32_t     us;
+  uint32_t     us_max;
+} tasks_task_t;
+static tasks_task_t      tasks_tasks[TASKS_MAX];
+static int               tasks_count;
+static volatile uint8_t  tasks_woken[TASKS_MAX]; // Set by tasks_wake(); a byte per task, so setting needs no lock
+static uint32_t          tasks_idle_us; // Time slept since the last report
+static uint32_t          tasks_report_us;
+
+
+int tasks_add(const char * name, void (*fn)(), uint32_t period_ms) {
+  if( tasks_count==TASKS_MAX ) { Serial.printf("task: no room for '%s'\n",name); return -1; }
+  tasks_task_t * t = &tasks_tasks[tasks_count];
+  t->name = name;
+  t->fn = fn;
+  t->period_ms = period_ms;
+  t->due_ms = millis();
+  t->armed = period_ms>0;
+  return tasks_count++;
+}
+
+
+void tasks_at(int id, uint32_t ms) {
+  tasks_tasks[id].due_ms = millis()+ms;
+  tasks_tasks[id].armed = true;
+}
+
+
+void tasks_stop(int id) {
+  tasks_tasks[id].armed = false;
+}
+
+
+IRAM_ATTR void tasks_wake(int id) {
+  tasks_woken[id] = 1;
+  esp_schedule(); // Ends esp_delay() in tasks_run()
+}
+
+
+// Returns true when no task is woken (so esp_delay() continues sleeping)
+static bool tasks_asleep() {
+  for( int id=0; id<tasks_count; id++ ) if( tasks_woken[id] ) return false;
+  return true;
+}
+
+
+void tasks_run() {
+  // Move the woken tasks to the armed ones (a wake between the test and the clear is not lost: the task runs after it)
+  uint32_t now = millis();
+  for( int id=0; id<tasks_count; id++ ) if( tasks_woken[id] ) { tasks_woken[id] = 0; tasks_tasks[id].due_ms = now; tasks_tasks[id].armed = true; }
+  // Run the due tasks
+  for( int id=0; id<tasks_count; id++ ) {
+    tasks_task_t * t = &tasks_tasks[id];
+    if( !t->armed || (int32_t)(millis()-t->due_ms)<0 ) continue;
+    if( t->period_ms>0 ) {
+      t->due_ms += t->period_ms;
+      if( (int32_t)(millis()-t->due_ms)>=0 ) t->due_ms = millis()+t->period_ms; // Fell behind: skip the missed runs
+    } else {
+      t->armed = false; // The task may re-arm itself
+    }
+    uint32_t t0 = micros();
+    t->fn();
+    uint32_t us = micros()-t0;
+    t->runs++;
+    t->us += us;
+    if( us>t->us_max ) t->us_max = us;
+  }
+  // Sleep until the next deadline (or a wake)
+  now = millis();
+  uint32_t wait = 1000; // Also bounds the sleep when no task is armed
+  for( int id=0; id<tasks_count; id++ ) {
+    tasks_task_t * t = &tasks_tasks[id];
+    if( !t->armed ) continue;
+    int32_t left = t->due_ms-now;
+    if( left<=0 ) { wait = 0; break; }
+    if( (uint32_t)left<wait ) wait = left;
+  }
+  uint32_t t0 = micros();
+  if( wait>0 ) esp_delay(wait, tasks_asleep);
+  else yield(); // Let the SDK (WiFi) run
+  tasks_idle_us += micros()-t0;
+}
+
+
+void tasks_report() {
+  uint32_t now = micros();
+  uint32_t total = now-tasks_report_us;
+  uint32_t permille = total ? (uint64_t)tasks_idle_us*1000/total : 0;
+  Serial.printf("task: idle %u.%u%% of %u ms\n", (unsigned)(permille/10), (unsigned)(permille%10), (unsigned)(total/1000) );
+  for( int id=0; id<tasks_count; id++ ) {
+    tasks_task_t * t = &tasks_tasks[id];
+    Serial.printf("task: %-6s runs %u, avg %u us, max %u us\n", t->name, t->runs, t->runs ? t->us/t->runs : 0, t->us_max );
+    t->runs = 0; t->us = 0; t->us_max = 0;
+  }
+  tasks_idle_us = 0;
+  tasks_report_us = now;
+}
@@ -0,0 +1,33 @@
+// tasks.h - interface to a cooperative scheduler: tasks with deadlines, the CPU sleeps in between
+#ifndef _TASKS_H_
+#define _TASKS_H_
+
+
+#include <stdint.h>
+
+
+#define TASKS_MAX 8 // Maximum number of tasks
+
+
+// Registers task `fn` (under `name`, for the report). With a `period_ms` it runs periodically, the first time right away;
+// with 0 it is a one-shot that runs when armed with tasks_at() or tasks_wake(). Returns the task id (-1 if the table is full).
+int  tasks_add(const char * name, void (*fn)(), uint32_t period_ms);
+
+// (Re)arms task `id` to run in `ms` (a periodic task continues with its period from there)
+void tasks_at(int id, uint32_t ms);
+
+// Disarms task `id`
+void tasks_stop(int id);
+
+// Makes task `id` due now and ends the sleep of tasks_run(). May be called from an interrupt handler or timer callback.
+void tasks_wake(int id);
+
+// Runs the tasks that are due, then sleeps until the next deadline or wake. Call from loop().
+// The sleep is a delay, so the SDK runs WiFi meanwhile, and (with WIFI_LIGHT_SLEEP) may light-sleep.
+void tasks_run();
+
+// Logs per-task run count and run time, and the idle fraction, since the previous report
+void tasks_report();
+
+
+#endif
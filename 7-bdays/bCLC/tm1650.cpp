@@ -0,0 +1,96 @@
+// tm1650.cpp - fast driver for the TM1650 on the 303WIFILC01 board
+
+#include <Arduino.h>
+#include "tm1650.h"
+
+
+// The (semi) I2C connections on the 303WIFILC01 board
+#define TM1650_SCL_PIN 12
+#define TM1650_SDA_PIN 13
+#define TM1650_SCL     (1<<TM1650_SCL_PIN)
+#define TM1650_SDA     (1<<TM1650_SDA_PIN)
+
+
+// The lines are open drain (like Wire does it): the output latch of a pin is kept low, so enabling its
+// output pulls the line low, and disabling the output releases the line (the pull-up makes it high).
+#define TM1650_LOW(m)  ( GPES = (m) )
+#define TM1650_HIGH(m) ( GPEC = (m) )
+#define TM1650_READ(m) ( (GPI & (m))!=0 )
+
+
+static uint32_t tm1650_hz;   // Configured bus clock
+static uint32_t tm1650_half; // Half a clock period in CPU cycles
+
+
+// Waits till half a clock period passed since `*t`, then sets `*t` to now
+static inline IRAM_ATTR void tm1650_wait(uint32_t * t) {
+  while( ESP.getCycleCount() - *t < tm1650_half ) { /* spin */ }
+  *t = ESP.getCycleCount();
+}
+
+
+// Sends byte `b` (SCL is low on entry and exit). Returns 0 when the TM1650 acknowledged, 1 if not.
+static IRAM_ATTR int tm1650_byte(uint8_t b, uint32_t * t) {
+  for( uint8_t mask=0x80; mask; mask>>=1 ) {
+    if( b & mask ) TM1650_HIGH(TM1650_SDA); else TM1650_LOW(TM1650_SDA);
+    tm1650_wait(t);
+    TM1650_HIGH(TM1650_SCL);
+    tm1650_wait(t);
+    TM1650_LOW(TM1650_SCL);
+  }
+  // Ninth clock: TM1650 pulls SDA low to acknowledge
+  TM1650_HIGH(TM1650_SDA);
+  tm1650_wait(t);
+  TM1650_HIGH(TM1650_SCL);
+  tm1650_wait(t);
+  int nack = TM1650_READ(TM1650_SDA);
+  TM1650_LOW(TM1650_SCL);
+  return nack;
+}
+
+
+// One transaction: START cmd val STOP (bus is idle, both lines high, on entry and exit)
+static IRAM_ATTR int tm1650_xfer(uint8_t cmd, uint8_t val, uint32_t * t) {
+  TM1650_LOW(TM1650_SDA); // START: SDA falls while SCL is high
+  tm1650_wait(t);
+  TM1650_LOW(TM1650_SCL);
+  int nacks = tm1650_byte(cmd,t);
+  nacks += tm1650_byte(val,t);
+  TM1650_LOW(TM1650_SDA); // STOP: SDA rises while SCL is high
+  tm1650_wait(t);
+  TM1650_HIGH(TM1650_SCL);
+  tm1650_wait(t);
+  TM1650_HIGH(TM1650_SDA);
+  tm1650_wait(t);
+  return nacks;
+}
+
+
+void tm1650_init(uint32_t hz) {
+  pinMode(TM1650_SDA_PIN, INPUT_PULLUP);
+  pinMode(TM1650_SCL_PIN, INPUT_PULLUP);
+  GPOC = TM1650_SDA | TM1650_SCL; // output latches low, see TM1650_LOW
+  if( hz<1000 ) hz = 1000;
+  tm1650_hz = hz;
+  tm1650_half = ESP.getCpuFreqMHz()*1000000UL / hz / 2;
+}
+
+
+uint32_t tm1650_clock() {
+  return tm1650_hz;
+}
+
+
+IRAM_ATTR int tm1650_write(uint8_t cmd, uint8_t val) {
+  uint32_t t = ESP.getCycleCount();
+  return tm1650_xfer(cmd,val,&t);
+}
+
+
+IRAM_ATTR int tm1650_frame(const uint8_t * segs, uint8_t control) {
+  uint32_t t = ESP.getCycleCount();
+  int nacks = 0;
+  for( int i=0; i<4; i++ ) nacks += tm1650_xfer(TM1650_DIGIT1+2*i, segs[i], &t);
+  nacks += tm1650_xfer(TM1650_CONTROL, control, &t);
+  return nacks;
+}
@@ -1,11 +1,46 @@
 // wifi.cpp - control the wifi
 
 #include <ESP8266WiFi.h>
-#include <ESP8266WiFiMulti.h>
+#include <coredecls.h> // crc32()
 #include "wifi.h"
 
 
-ESP8266WiFiMulti wifi;
+// The connection is a state machine driven by the WiFi events (scan done, got IP, disconnected) and by wifi_step()
+// (timeouts, backoff). Nothing blocks: a scan is asynchronous, and so is connecting.
+#define WIFI_STATE_IDLE       0 // Next: start a scan
+#define WIFI_STATE_SCANNING   1 // Waiting for the scan result
+#define WIFI_STATE_SCANNED    2 // Scan done, wifi_ap_chosen is the AP to connect to (or -1)
+#define WIFI_STATE_CONNECTING 3 // Waiting for an IP address (wifi_fast: with the cached AP and lease, skipping scan and DHCP)
+#define WIFI_STATE_CONNECTED  4
+#define WIFI_STATE_FAILED     5 // Connection failed or lost; next: backoff
+#define WIFI_STATE_BACKOFF    6 // Waiting wifi_backoff_ms before scanning again
+
+
+#define WIFI_APS            3
+#define WIFI_SCAN_MS    10000 // Timeout for a scan
+#define WIFI_CONNECT_MS 15000 // Timeout for associating and getting an IP address
+#define WIFI_FAST_MS     3000 // Same, for the fast path; on failure it falls back to a scan
+#define WIFI_BACKOFF_MIN  1000
+#define WIFI_BACKOFF_MAX 64000
+
+
+static const char *      wifi_ssid[WIFI_APS];
+static const char *      wifi_pass[WIFI_APS];
+static uint8_t           wifi_fails[WIFI_APS];  // Consecutive failures per AP (to try another one when it does not work)
+static int               wifi_ap_count;
+static volatile int      wifi_state = WIFI_STATE_IDLE;
+static volatile int      wifi_ap_chosen;        // AP (index in wifi_ssid) chosen by the scan, -1 if none is in range
+static uint8_t           wifi_ap_bssid[6];      // The BSSID and channel of the chosen AP
+static int32_t           wifi_ap_channel;
+static int               wifi_ap_connected = -1;// AP (index) connecting to or connected to
+static uint32_t          wifi_state_ms;         // Time the state was entered
+static uint32_t          wifi_backoff_ms = WIFI_BACKOFF_MIN; // Backoff for the next failure (doubles per failure)
+static uint32_t          wifi_retry_ms;         // Backoff for the current failure
+static bool              wifi_fast;             // Connecting via the fast path (see wifi_cache_t), till the connection is up
+static WiFiEventHandler  wifi_handler_connected;
+static WiFiEventHandler  wifi_handler_gotip;
+static WiFiEventHandler  wifi_handler_disconnected;
+static void           (* wifi_notify_fn)();
 
 
 // Sets host name, based on MAC address
@@ -28,41 +63,206 @@ static void wifi_sethostname(int len=WL_MAC_ADDR_LENGTH) {
 }
 
 
+// The last successful connection (AP, BSSID, channel and DHCP lease) is kept in RTC memory, which survives a reset
+// (also the one after an OTA update, but not a power cycle). At boot, the fast path connects to that AP on that
+// channel with that IP configuration: no scan and no DHCP, so it is associated in a fraction of a second. Once it is
+// connected, the address is handed back to DHCP, so that its lease is renewed.
+#define WIFI_CACHE_OFFSET 32 // In 4-byte blocks; the first 128 bytes of RTC user memory are used by OTA
+typedef struct wifi_cache_s {
+  uint32_t crc;      // Of the rest of the struct, so that garbage (power-up) is rejected
+  uint32_t ssidcrc;  // Of the SSID of AP `ap`, so that a configuration change invalidates the cache
+  uint8_t  ap;       // Index in wifi_ssid
+  uint8_t  channel;
+  uint8_t  bssid[6];
+  uint32_t ip, gw, mask, dns;
+} wifi_cache_t;
+static wifi_cache_t wifi_cache;
+
+
+// Computes the crc of the cache
+static uint32_t wifi_cache_crc() {
+  return crc32((const uint8_t*)&wifi_cache+sizeof(wifi_cache.crc), sizeof(wifi_cache)-sizeof(wifi_cache.crc));
+}
+
+
+// Reads the cache from RTC memory; returns true if it is valid for the configured APs
+static bool wifi_cache_load() {
+  if( !ESP.rtcUserMemoryRead(WIFI_CACHE_OFFSET, (uint32_t*)&wifi_cache, sizeof(wifi_cache)) ) return false;
+  if( wifi_cache.crc!=wifi_cache_crc() ) return false;
+  if( wifi_cache.ap>=wifi_ap_count ) return false;
+  return wifi_cache.ssidcrc==crc32(wifi_ssid[wifi_cache.ap], strlen(wifi_ssid[wifi_cache.ap]));
+}
+
+
+// Writes the cache to RTC memory (`valid` false invalidates it)
+static void wifi_cache_save(bool valid) {
+  wifi_cache.crc = wifi_cache_crc() ^ (valid ? 0 : 1);
+  ESP.rtcUserMemoryWrite(WIFI_CACHE_OFFSET, (uint32_t*)&wifi_cache, sizeof(wifi_cache));
+}
+
+
+// Enters `state` and tells the application
+static void wifi_enter(int state) {
+  wifi_state = state;
+  wifi_state_ms = millis();
+  if( wifi_notify_fn ) wifi_notify_fn();
+}
+
+
+// Scan done (WiFi event context): chooses the configured AP with the fewest recent failures, then the strongest signal
+static void wifi_scandone(int n) {
+  int best = -1, best_rssi = 0, best_ix = -1;
+  for( int i=0; i<n; i++ ) {
+    for( int ap=0; ap<wifi_ap_count; ap++ ) {
+      if( strcmp(WiFi.SSID(i).c_str(),wifi_ssid[ap])!=0 ) continue;
+      int32_t rssi = WiFi.RSSI(i);
+      if( best<0 || wifi_fails[ap]<wifi_fails[best] || (wifi_fails[ap]==wifi_fails[best] && rssi>best_rssi) ) { best = ap; best_rssi = rssi; best_ix = i; }
+    }
+  }
+  if( best>=0 ) {
+    memcpy(wifi_ap_bssid, WiFi.BSSID(best_ix), 6);
+    wifi_ap_channel = WiFi.channel(best_ix);
+    Serial.printf("wifi: scan: %d networks, AP%d %s (%d dBm, channel %d)\n", n, best+1, wifi_ssid[best], best_rssi, wifi_ap_channel);
+  } else {
+    Serial.printf("wifi: scan: %d networks, no configured AP\n", n<0 ? 0 : n);
+  }
+  WiFi.scanDelete();
+  wifi_ap_chosen = best;
+  wifi_enter(WIFI_STATE_SCANNED);
+}
+
+
 // Initializes the WiFi driver.
-// Sets up WiFi for the three SSIDs the user configured.
+// Sets up WiFi for the three SSIDs the user configured, and starts connecting.
 void wifi_init(char*s1,char*p1,char*s2,char*p2, char*s3,char*p3) {
   wifi_sethostname(3);
   WiFi.persistent(false);
   WiFi.mode(WIFI_STA);
+  WiFi.setAutoReconnect(false); // Reconnecting (with backoff, possibly to another AP) is done by wifi_step()
+  WiFi.setSleepMode(WIFI_LIGHT_SLEEP); // While the scheduler waits for the next task, the SDK may light-sleep between beacons
 
   Serial.printf("wifi: APs:");
   // Get AP's from config. 1st is mandatory, others are optional
-  if( s1[0]!='0' ) {
-    wifi.addAP(s1,p1);
-    Serial.printf(" %s",s1);
+  char * ss[WIFI_APS] = {s1,s2,s3};
+  char * ps[WIFI_APS] = {p1,p2,p3};
+  wifi_ap_count = 0;
+  for( int i=0; i<WIFI_APS; i++ ) {
+    if( ss[i][0]=='\0' || ss[i][0]=='0' ) continue;
+    wifi_ssid[wifi_ap_count] = ss[i];
+    wifi_pass[wifi_ap_count] = ps[i];
+    wifi_ap_count++;
+    Serial.printf(" %s",ss[i]);
   }
-  if( s2[0]!='0' ) {
-    wifi.addAP(s2,p2);
-    Serial.printf(" %s",s2);
+  Serial.printf("\n");
+
+  wifi_handler_connected = WiFi.onStationModeConnected( [](const WiFiEventStationModeConnected & ev) {
+    if( wifi_state!=WIFI_STATE_CONNECTING ) return;
+    Serial.printf("wifi: associated with %s (channel %d) %u ms after boot%s\n", wifi_ssid[wifi_ap_connected], ev.channel, (unsigned)millis(), wifi_fast?" (fast)":"" );
+  });
+  wifi_handler_gotip = WiFi.onStationModeGotIP( [](const WiFiEventStationModeGotIP & ev) {
+    if( wifi_state==WIFI_STATE_CONNECTED ) {
+      // DHCP bound (again), e.g. after the fast path handed the address back to it: keep that lease for the next fast path
+      Serial.printf("wifi: DHCP lease, IP address %s\n", ev.ip.toString().c_str() );
+      wifi_cache.ip = ev.ip; wifi_cache.gw = ev.gw; wifi_cache.mask = ev.mask; wifi_cache.dns = WiFi.dnsIP(0);
+      wifi_cache_save(true);
+      return;
+    }
+    if( wifi_state!=WIFI_STATE_CONNECTING ) return;
+    Serial.printf("wifi: connected to %s, IP address %s, %u ms after boot%s\n", WiFi.SSID().c_str(), ev.ip.toString().c_str(), (unsigned)millis(), wifi_fast?" (fast)":"" );
+    // Remember this connection for the fast path after a reset
+    wifi_cache.ssidcrc = crc32(wifi_ssid[wifi_ap_connected], strlen(wifi_ssid[wifi_ap_connected]));
+    wifi_cache.ap = wifi_ap_connected;
+    wifi_cache.channel = WiFi.channel();
+    memcpy(wifi_cache.bssid, WiFi.BSSID(), 6);
+    wifi_cache.ip = ev.ip; wifi_cache.gw = ev.gw; wifi_cache.mask = ev.mask; wifi_cache.dns = WiFi.dnsIP(0);
+    wifi_cache_save(true);
+    if( wifi_fast ) {
+      // The cached address is configured as static, so its lease would not be renewed: hand it back to DHCP (which
+      // requests a lease, normally for the same address). Later disconnects take the normal path (backoff, cache kept).
+      WiFi.config(IPAddress(0u), IPAddress(0u), IPAddress(0u));
+      wifi_fast = false;
+    }
+    wifi_fails[wifi_ap_connected] = 0;
+    wifi_backoff_ms = WIFI_BACKOFF_MIN;
+    wifi_enter(WIFI_STATE_CONNECTED);
+  });
+  wifi_handler_disconnected = WiFi.onStationModeDisconnected( [](const WiFiEventStationModeDisconnected & ev) {
+    if( wifi_state==WIFI_STATE_CONNECTED ) Serial.printf("wifi: disconnected (reason %d)\n", ev.reason );
+    else if( wifi_state==WIFI_STATE_CONNECTING ) Serial.printf("wifi: connect to %s failed (reason %d)\n", wifi_ssid[wifi_ap_connected], ev.reason );
+    else return;
+    wifi_enter(WIFI_STATE_FAILED);
+  });
+
+  // Fast path when the cache is valid, otherwise scan
+  if( wifi_cache_load() ) {
+    Serial.printf("wifi: fast connect to %s (channel %d, IP address %s)\n", wifi_ssid[wifi_cache.ap], wifi_cache.channel, IPAddress(wifi_cache.ip).toString().c_str() );
+    WiFi.config(IPAddress(wifi_cache.ip), IPAddress(wifi_cache.gw), IPAddress(wifi_cache.mask), IPAddress(wifi_cache.dns));
+    wifi_fast = true;
+    wifi_ap_connected = wifi_cache.ap;
+    wifi_enter(WIFI_STATE_CONNECTING);
+    WiFi.begin(wifi_ssid[wifi_ap_connected], wifi_pass[wifi_ap_connected], wifi_cache.channel, wifi_cache.bssid);
+  } else {
+    wifi_step();
   }
-  if( s3[0]!='0' ) {
-    wifi.addAP(s3,p3);
-    Serial.printf(" %s",s3);
+}
+
+
+// Advances the connection state machine (timeouts, retries with backoff)
+void wifi_step() {
+  uint32_t ms = millis()-wifi_state_ms;
+  switch( wifi_state ) {
+    case WIFI_STATE_BACKOFF:
+      if( ms<wifi_retry_ms ) break;
+      // fall through
+    case WIFI_STATE_IDLE:
+      if( wifi_ap_count==0 ) break;
+      wifi_enter(WIFI_STATE_SCANNING);
+      WiFi.scanNetworksAsync(wifi_scandone);
+      break;
+    case WIFI_STATE_SCANNING:
+      if( ms>=WIFI_SCAN_MS ) { Serial.printf("wifi: scan timeout\n"); wifi_enter(WIFI_STATE_FAILED); }
+      break;
+    case WIFI_STATE_SCANNED:
+      if( wifi_ap_chosen<0 ) { wifi_enter(WIFI_STATE_FAILED); break; }
+      wifi_ap_connected = wifi_ap_chosen;
+      wifi_enter(WIFI_STATE_CONNECTING);
+      WiFi.begin(wifi_ssid[wifi_ap_connected], wifi_pass[wifi_ap_connected], wifi_ap_channel, wifi_ap_bssid);
+      break;
+    case WIFI_STATE_CONNECTING:
+      if( ms>=(wifi_fast ? WIFI_FAST_MS : WIFI_CONNECT_MS) ) { Serial.printf("wifi: connect to %s timeout\n", wifi_ssid[wifi_ap_connected]); wifi_enter(WIFI_STATE_FAILED); }
+      break;
+    case WIFI_STATE_CONNECTED:
+      break;
+    case WIFI_STATE_FAILED:
+      WiFi.disconnect();
+      if( wifi_fast ) {
+        // The fast path failed (AP moved, other channel, ...): back to DHCP, and scan right away
+        Serial.printf("wifi: fast connect failed, scanning\n");
+        WiFi.config(IPAddress(0u), IPAddress(0u), IPAddress(0u));
+        wifi_cache_save(false);
+        wifi_fast = false;
+        wifi_ap_connected = -1;
+        wifi_enter(WIFI_STATE_IDLE);
+        wifi_step();
+        break;
+      }
+      if( wifi_ap_connected>=0 && wifi_fails[wifi_ap_connected]<255 ) wifi_fails[wifi_ap_connected]++;
+      wifi_ap_connected = -1;
+      wifi_retry_ms = wifi_backoff_ms;
+      wifi_backoff_ms = min(2*wifi_backoff_ms, (uint32_t)WIFI_BACKOFF_MAX);
+      Serial.printf("wifi: retry in %u ms\n", wifi_retry_ms);
+      wifi_enter(WIFI_STATE_BACKOFF);
+      break;
   }
-  Serial.printf("\n");
-  wifi_isconnected();
 }
 
 
-// Prints WiFi status to the user (over Serial, only when changed), and returns true iff connected
+// Returns true iff connected
 bool wifi_isconnected() {
-  static bool wifi_on= false;
-  if( wifi.run()==WL_CONNECTED ) { // Unfortunately, this is a blocking call
-    if( !wifi_on ) Serial.printf("wifi: connected to %s, IP address %s\n", WiFi.SSID().c_str(), WiFi.localIP().toString().c_str() );
-    wifi_on= true;
-  } else {
-    if( wifi_on ) Serial.printf("wifi: disconnected\n" );
-    wifi_on= false;    
-  }
-  return wifi_on;
+  return wifi_state==WIFI_STATE_CONNECTED;
+}
+
+
+void wifi_notify(void (*fn)()) {
+  wifi_notify_fn = fn;
 }
@@ -3,8 +3,10 @@
 #define _WIFI_H_
 
 
-void wifi_init(char*s1,char*p1,char*s2,char*p2, char*s3,char*p3); // Initializes the WiFi driver
-bool wifi_isconnected(); // Prints WiFi status to the user (over Serial, only when changed), and returns true iff connected
+void wifi_init(char*s1,char*p1,char*s2,char*p2, char*s3,char*p3); // Initializes the WiFi driver (up to three APs), and starts connecting
+void wifi_step();          // Advances the connection state machine (timeouts, retries with backoff); call regularly, e.g. every second and after a notify
+bool wifi_isconnected();   // Returns true iff connected (has an IP address); a cached state, so it does not block
+void wifi_notify(void (*fn)()); // Sets `fn` to be called (from the WiFi event context) when the state changes, e.g. to wake the loop; 0 for none
 
 
 #endif